@@ -0,0 +1,32 @@
+#include "AnalysisProcessor.h"
+#include <algorithm>
+
+void AnalysisProcessor::reset() {
+  values.clear();
+}
+
+// The first frame starts the smoothing where it is
+void AnalysisProcessor::update(const AnalysisRecording& recording, size_t frame) {
+  size_t scalarCount = recording.getScalarCount();
+  if (values.size() != scalarCount) {
+    values.resize(scalarCount);
+    for (size_t scalar = 0; scalar < scalarCount; scalar++) values[scalar] = recording.getScalar(frame, scalar);
+    return;
+  }
+  for (size_t scalar = 0; scalar < scalarCount; scalar++) {
+    values[scalar] += NEWEST_FRAME_WEIGHT * (recording.getScalar(frame, scalar) - values[scalar]);
+  }
+}
+
+float AnalysisProcessor::getNormalisedScalarValue(size_t scalar, float min, float max) const {
+  if (max == min) return 0.0;
+  return std::clamp((values[scalar] - min) / (max - min), 0.0f, 1.0f);
+}
+
+bool AnalysisProcessor::isDataValid(const std::vector<ValiditySpec>& specs) const {
+  for (const auto& spec : specs) {
+    float value = values[spec.scalar];
+    if (spec.upper ? value > spec.threshold : value < spec.threshold) return false;
+  }
+  return true;
+}
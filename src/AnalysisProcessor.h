@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "AnalysisRecording.h"
+
+// The audio features a batch render is drawn from, worked out from recorded analysis frames the way
+// ofxAudioData::Processor works them out from its client: each scalar smoothed over the frames
+// stepped through, normalised into a range, and the frame judged valid against thresholds. Batch
+// mode steps one of these through a recording on its fixed clock, so the audio parameters in force
+// now apply to archived sessions as they would live.
+//
+// Scalars are indexed by column, in ofxAudioAnalysisClient::AnalysisScalar order as recorded.
+class AnalysisProcessor {
+
+public:
+  // As ofxAudioData::ValiditySpec: valid while the scalar is above a lower threshold, or below an upper one
+  struct ValiditySpec {
+    size_t scalar;
+    bool upper;
+    float threshold;
+  };
+
+  void reset();
+  void update(const AnalysisRecording& recording, size_t frame);
+
+  float getScalarValue(size_t scalar) const { return values[scalar]; } // smoothed
+  float getNormalisedScalarValue(size_t scalar, float min, float max) const; // clamped to [0, 1]
+  bool isDataValid(const std::vector<ValiditySpec>& specs) const;
+
+private:
+  static constexpr float NEWEST_FRAME_WEIGHT = 0.5; // of the exponential smoothing
+
+  std::vector<float> values;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// A recorded stream of audio analysis frames: a time for each frame and a fixed number of values
+// per frame, the raw analysis columns as the recorder wrote them (scalars in
+// ofxAudioAnalysisClient::AnalysisScalar order, then the spectrum bins), so they can be processed
+// with whatever audio parameters are in force when replayed.
+class AnalysisRecording {
+
+public:
+  virtual ~AnalysisRecording() = default;
+
+  virtual size_t size() const = 0;
+  virtual size_t getScalarCount() const = 0;
+  virtual double getTime(size_t frame) const = 0; // seconds
+  virtual float getScalar(size_t frame, size_t scalar) const = 0;
+
+  // Last frame recorded at or before time, or the first frame
+  virtual size_t frameAt(double time) const = 0;
+
+  double getDuration() const { return size() == 0 ? 0.0 : getTime(size() - 1); }
+};
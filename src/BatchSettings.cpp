@@ -0,0 +1,72 @@
+#include "BatchSettings.h"
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+void printUsage(const char* program) {
+  std::cerr << "usage: " << program << " [--batch SESSION.oscs|SESSION.oscb [--out DIR] [--settings FILE.xml] [--seed N]"
+            << " [--frames N] [--snapshot-every N] [--plot-every N] [--profile]]" << std::endl
+            << "       " << program << " --convert SESSION.oscs SESSION.oscb" << std::endl
+            << "       " << program << " --benchmark-fluid" << std::endl;
+}
+
+bool parseCount(const char* text, uint64_t& value) {
+  char* end;
+  value = std::strtoull(text, &end, 10);
+  return *text && !*end;
+}
+
+}
+
+bool parseBatchSettings(int argc, char* argv[], BatchSettings& settings) {
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if (option == "--profile") {
+      settings.profile = true;
+      continue;
+    }
+    if (option == "--benchmark-fluid") {
+      settings.fluidBenchmark = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      // macOS passes -NSDocumentRevisionsDebugMode etc. when run from Xcode
+      if (option.rfind("-NS", 0) == 0) continue;
+      printUsage(argv[0]);
+      return false;
+    }
+    const char* value = argv[++i];
+    uint64_t count;
+    if (option == "--batch") {
+      settings.sessionPath = value;
+    } else if (option == "--convert" && i + 1 < argc) {
+      settings.convertInputPath = value;
+      settings.convertOutputPath = argv[++i];
+    } else if (option == "--out") {
+      settings.outputDirectory = value;
+    } else if (option == "--settings") {
+      settings.settingsPath = value;
+    } else if (option == "--seed" && parseCount(value, count)) {
+      settings.seed = count;
+    } else if (option == "--frames" && parseCount(value, count)) {
+      settings.frameLimit = count;
+    } else if (option == "--snapshot-every" && parseCount(value, count)) {
+      settings.snapshotInterval = count;
+    } else if (option == "--plot-every" && parseCount(value, count)) {
+      settings.plotInterval = count;
+    } else if (option.rfind("-NS", 0) == 0) {
+      continue;
+    } else {
+      printUsage(argv[0]);
+      return false;
+    }
+  }
+  bool batchOptionsWithoutBatch = !settings.outputDirectory.empty() || !settings.settingsPath.empty()
+    || settings.seed.has_value() || settings.frameLimit || settings.snapshotInterval || settings.plotInterval || settings.profile;
+  if (!settings.isEnabled() && batchOptionsWithoutBatch) {
+    printUsage(argv[0]);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Command line options for rendering a recorded session offline:
+//
+//   bells2 --batch SESSION.oscs|SESSION.oscb [--out DIR] [--settings FILE.xml] [--seed N] [--frames N]
+//          [--snapshot-every N] [--plot-every N] [--profile]
+//   bells2 --convert SESSION.oscs SESSION.oscb
+//   bells2 --benchmark-fluid
+//
+// The session's analysis frames are read straight from the file (see OscsReader) and stepped
+// through on a fixed clock of Constants::FRAME_RATE, as fast as frames can be rendered. Each
+// frame's scalars go through an AnalysisProcessor, so the audio parameters (ranges and validity
+// thresholds) from --settings apply as they would live.
+//
+// --convert writes the session's raw analysis columns to the memory-mapped format (see
+// MappedAnalysisRecording), which batch mode opens instantly rather than parsing the text again.
+//
+// Snapshots (PNG) and plots (SVG) are written every N frames, 0 for none, and a final snapshot
+// once the session ends. --profile times every stage and writes profile.csv and profile.json (see
+// StageProfiler) alongside them at the end, with profile-layers.csv giving the layer sizes, formats
+// and memory the timings are for. Rendering a session with a --settings file per layer
+// configuration benchmarks them against each other.
+//
+// --benchmark-fluid times the CPU fluid solver headless (see FluidBenchmark) and exits.
+//
+// Batch mode also runs on software GL, e.g. Mesa's llvmpipe with LIBGL_ALWAYS_SOFTWARE=1, so the
+// render paths can be exercised and profiled on a machine without a GPU.
+struct BatchSettings {
+  std::string sessionPath; // empty when not in batch mode
+  std::string convertInputPath; // set with convertOutputPath to convert a session and exit
+  std::string convertOutputPath;
+  std::string outputDirectory; // defaults to ~/Documents/bells2/<session name>
+  std::string settingsPath; // gui settings to load, as saved from the panel
+  std::optional<uint64_t> seed; // the same seed renders the same session the same way; random without one
+  size_t frameLimit { 0 }; // 0 renders the whole session
+  size_t snapshotInterval { 0 };
+  size_t plotInterval { 0 };
+  bool profile { false };
+  bool fluidBenchmark { false };
+
+  bool isEnabled() const { return !sessionPath.empty(); }
+  bool isConversion() const { return !convertInputPath.empty(); }
+};
+
+// False (after printing usage) if the arguments are malformed
+bool parseBatchSettings(int argc, char* argv[], BatchSettings& settings);
@@ -0,0 +1,443 @@
+#include "BellsEngine.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "glm/common.hpp"
+#include "StageProfiler.h"
+#include "Constants.h"
+
+using namespace DrawCommands;
+
+void BellsEngine::setup(uint64_t seed) {
+  randomEngine.seed(seed);
+  somTrainer.setup(Constants::SOM_WIDTH, Constants::SOM_HEIGHT, 0.1, 3000, seed);
+  somColors = somTrainer.getSnapshot();
+
+  clusterParameters.add(clusterCentresParameter);
+  clusterParameters.add(clusterSourceSamplesMaxParameter);
+  clusterParameters.add(clusterRefineIterationsParameter);
+  clusterParameters.add(clusterThreadsParameter);
+  clusterParameters.add(clusterAcceleratedParameter);
+  clusterParameters.add(clusterMiniBatchParameter);
+  clusterParameters.add(clusterBatchSizeParameter);
+  clusterParameters.add(clusterMinLearningRateParameter);
+  clusterParameters.add(clusterDecayRateParameter);
+  clusterParameters.add(sameClusterToleranceParameter);
+  clusterParameters.add(clusterTrackedParameter);
+  clusterParameters.add(sampleNoteClustersParameter);
+  clusterParameters.add(sampleNotesParameter);
+
+  somParameters.add(somThreadsParameter);
+  somParameters.add(somNeighbourhoodCutoffParameter);
+  somParameters.add(somAsyncParameter);
+  somParameters.add(somPublishIntervalParameter);
+
+  impulseParameters.add(impulseRadiusParameter);
+  impulseParameters.add(impulseRadialVelocityParameter);
+}
+
+size_t BellsEngine::randomIndex(size_t count) {
+  return randomEngine.index(static_cast<uint32_t>(count));
+}
+
+float BellsEngine::randomUniform() {
+  return randomEngine.uniform();
+}
+
+const std::vector<DrawCommand>& BellsEngine::update(const AudioFrame& frame) {
+  PROFILE_STAGE("update-engine");
+  commands.clear();
+
+  somTrainer.setAsync(somAsyncParameter);
+  somTrainer.setPublishInterval(somPublishIntervalParameter);
+  somTrainer.setThreadCount(somThreadsParameter);
+  somTrainer.setNeighbourhoodCutoff(somNeighbourhoodCutoffParameter);
+  somColors = somTrainer.getSnapshot();
+
+  if (clusterTracked != clusterTrackedParameter) {
+    clusterTracked = clusterTrackedParameter;
+    clusterCentres = ClusterCentres(); // start again from the next clusters
+    clusterTracker = ClusterTracker();
+  }
+  const std::vector<glm::vec4>& centres = getClusterCentres();
+
+  const float s = frame.s;
+  const float t = frame.t;
+  const float u = frame.u;
+  const float v = frame.v;
+
+  // The divisions below have always been drawn with whichever blend mode was last set in the frame
+  ofBlendMode divisionsBlendMode = OF_BLENDMODE_ALPHA;
+
+  if (frame.valid) {
+    {
+      PROFILE_STAGE("update-som");
+      somTrainer.add({ s, t, v });
+    }
+
+    ofFloatColor somColor = somColorAt(s, t);
+    ofFloatColor darkSomColor = somColor; darkSomColor.setBrightness(0.25); darkSomColor.setSaturation(1.0);
+
+    // Mark raw audio data sample in darkened SOM color on the foreground and fluid
+    commands.push_back(Circle { Layer::Foreground, OF_BLENDMODE_DISABLED, darkSomColor, { s, t }, 10.0f / Constants::CANVAS_WIDTH, false });
+    commands.push_back(Circle { Layer::Fluid, OF_BLENDMODE_DISABLED, darkSomColor, { s, t }, 3.0f / Constants::FLUID_WIDTH, false });
+
+    addNote(frame);
+    commands.push_back(IntrospectorCircle { { s, t }, 1.0f/Constants::WINDOW_WIDTH*5.0f, ofColor::yellow, true, 30 }); // introspection: small yellow circle for new raw source sample
+
+    {
+      PROFILE_STAGE("update-kmeans");
+      updateClusters();
+    }
+
+    {
+      PROFILE_STAGE("update-clusterCentres");
+      updateClusterCentres();
+    }
+
+    {
+      PROFILE_STAGE("update-fineStructure");
+      makeFineStructure(somColor);
+    }
+
+    // circles around longer-lasting clusterCentres into fluid layer
+    for (auto& p: centres) {
+      if (p.w < 5.0) continue;
+      commands.push_back(Circle { Layer::Fluid, OF_BLENDMODE_ADD, ofFloatColor(0.1, 0.1, 0.1, 0.6), { p.x, p.y }, u * 100.0f / Constants::FLUID_WIDTH, false });
+    }
+    divisionsBlendMode = OF_BLENDMODE_ADD;
+
+    if (centres.size() > 2) {
+      PROFILE_STAGE("update-divider");
+      size_t index1 = randomIndex(centres.size());
+      size_t index2 = randomIndex(centres.size());
+      bool dividedAreaChanged = dividedArea.updateUnconstrainedDividerLines(centres, { index1, index2 });
+      if (dividedAreaChanged) {
+        commands.push_back(Divisions { Layer::Fluid, OF_BLENDMODE_ALPHA, ofFloatColor(1.0, 1.0, 1.0, 0.7), 0.5f / Constants::FLUID_WIDTH, true, divisionSegments() });
+        commands.push_back(FreezeFluid {});
+        divisionsBlendMode = OF_BLENDMODE_ALPHA;
+      }
+    }
+  }
+
+  {
+    PROFILE_STAGE("decay-clusterCentres");
+    decayClusterCentres();
+  }
+
+  // divisions on foreground
+  commands.push_back(Divisions { Layer::Divisions, divisionsBlendMode, ofFloatColor(0.0, 0.0, 0.0, 1.0), 80.0f / Constants::CANVAS_WIDTH, false, divisionSegments() });
+
+  // arcs around longer-lasting clusterCentres into foreground
+  arcCentres.clear();
+  for (auto& p: centres) {
+    if (p.w >= 4.0) arcCentres.push_back({ p.x, p.y });
+  }
+  somColorsAt(arcCentres, arcColors);
+  size_t arcIndex = 0;
+  for (auto& p: centres) {
+    if (p.w < 4.0) continue;
+    ofFloatColor darkSomColor = arcColors[arcIndex++]; darkSomColor.setBrightness(0.7); darkSomColor.setSaturation(1.0);
+    darkSomColor.a = 0.7;
+    float radius = std::fmod(p.w*5.0, 480) / Constants::CANVAS_WIDTH;
+    commands.push_back(Arc { Layer::Foreground, OF_BLENDMODE_ALPHA, darkSomColor, { p.x, p.y }, radius, -180.0f*(u+p.x), 180.0f*(v+p.y) });
+  }
+
+  // plot arcs around longer-lasting clusterCentres
+  for (auto& p: centres) {
+    if (p.w < 4.0) continue;
+    float radius = std::fmod(p.w*5.0/Constants::CANVAS_WIDTH, 480.0/Constants::CANVAS_WIDTH);
+    commands.push_back(PlotArc { { p.x, p.y }, radius, -180.0f*(u+p.x), 180.0f*(v+p.y), ofColor::blue, 30 });
+  }
+
+  // plot divisions
+  for (auto& l : dividedArea.unconstrainedDividerLines) {
+    commands.push_back(PlotLine { l.start, l.end, ofColor::black, 10 });
+  }
+
+  // fluid impulses at the cluster means
+  somColorsAt(clusterMeans(), impulseColors);
+  for (size_t i = 0; i < clusterMeans().size(); i++) {
+    float x = clusterMeans()[i][0]; float y = clusterMeans()[i][1];
+    const float COL_FACTOR = 0.008;
+    ofFloatColor color = impulseColors[i] * COL_FACTOR;
+    color.a = 0.005 * randomUniform();
+    commands.push_back(FluidImpulse { { x, y }, impulseRadiusParameter, impulseRadialVelocityParameter, color, 1.0 });
+  }
+
+  return commands;
+}
+
+// Maintain recent notes, evicting the oldest and keeping noteClusters in step
+void BellsEngine::addNote(const AudioFrame& frame) {
+  if (noteHistory.getCapacity() != clusterSourceSamplesMaxParameter) {
+    noteHistory.setCapacity(clusterSourceSamplesMaxParameter);
+    noteClusters = dkm::kmeans_state<float, 2>(dkm::clustering_parameters<float>(clusterCentresParameter)); // slots were renumbered
+  }
+  if (noteHistory.isFull()) {
+    size_t slot = noteHistory.getNextSlot();
+    std::array<float, 2> evictedXY = noteHistory.getXY(slot);
+    noteHistory.add(frame.s, frame.t, frame.time, frame.u, frame.v);
+    noteClusters.replace_point(slot, evictedXY, noteHistory.getXY(slot));
+  } else {
+    size_t slot = noteHistory.add(frame.s, frame.t, frame.time, frame.u, frame.v);
+    noteClusters.add_point(noteHistory.getXY(slot));
+  }
+}
+
+void BellsEngine::updateClusters() {
+  const auto& recentNoteXYs = noteHistory.getXYs();
+  if (recentNoteXYs.size() <= clusterCentresParameter) return;
+
+  if (clusterMiniBatchParameter) {
+    if (noteClusters.is_seeded()) {
+      noteClusters = dkm::kmeans_state<float, 2>(dkm::clustering_parameters<float>(clusterCentresParameter)); // stop tracking notes until Lloyd is used again
+    }
+    const auto& miniBatchParameters = miniBatchNoteClusters.get_parameters();
+    if (!miniBatchNoteClusters.is_seeded()
+        || miniBatchParameters.get_k() != clusterCentresParameter
+        || miniBatchParameters.get_batch_size() != clusterBatchSizeParameter
+        || miniBatchParameters.get_min_learning_rate() != clusterMinLearningRateParameter) {
+      dkm::minibatch_parameters<float> params(clusterCentresParameter);
+      params.set_batch_size(clusterBatchSizeParameter);
+      params.set_min_learning_rate(clusterMinLearningRateParameter);
+      params.set_random_seed(randomEngine());
+      miniBatchNoteClusters = dkm::kmeans_minibatch_state<float, 2>(params);
+      miniBatchNoteClusters.seed(recentNoteXYs);
+    }
+    for (int i = 0; i < clusterRefineIterationsParameter; i++) {
+      miniBatchNoteClusters.step(recentNoteXYs);
+    }
+  } else {
+    if (miniBatchNoteClusters.is_seeded()) {
+      miniBatchNoteClusters = dkm::kmeans_minibatch_state<float, 2>(dkm::minibatch_parameters<float>(1));
+    }
+    if (!noteClusters.is_seeded() || noteClusters.get_k() != clusterCentresParameter) {
+      dkm::clustering_parameters<float> params(clusterCentresParameter);
+      params.set_random_seed(randomEngine());
+      noteClusters = dkm::kmeans_state<float, 2>(params);
+      noteClusters.seed(recentNoteXYs);
+    }
+    if (clusterAcceleratedParameter && clusterThreadsParameter == 1) {
+      noteClusters.refine_accelerated(recentNoteXYs, clusterRefineIterationsParameter, &clusterStatistics);
+    } else {
+      clusterThreadPool.set_thread_count(clusterThreadsParameter);
+      dkm::refine_parallel(noteClusters, recentNoteXYs, clusterRefineIterationsParameter, clusterThreadPool);
+    }
+  }
+}
+
+// add to clusterCentres from new clusters
+void BellsEngine::updateClusterCentres() {
+  if (clusterTracked) {
+    const auto& means = clusterMeans();
+    for (size_t i : clusterTracker.update(means, sameClusterToleranceParameter)) {
+      commands.push_back(IntrospectorCircle { { means[i][0], means[i][1] }, 20.0f*1.0f/Constants::WINDOW_WIDTH, ofColor::red, true, 100 }); // introspection: large red circle is new cluster centre
+    }
+    if (!means.empty() && noteHistory.size() > clusterCentresParameter) {
+      clusterTracker.countNotes(clusterNoteCounts());
+      for (size_t track = 0; track < clusterTracker.size(); track++) {
+        const glm::vec4& p = clusterTracker.getCentres()[track];
+        float share = static_cast<float>(clusterTracker.getNotes(track)) / noteHistory.size();
+        commands.push_back(IntrospectorCircle { { p.x, p.y }, std::sqrt(share) * 200.0f/Constants::WINDOW_WIDTH, ofColor::white, false, 1 }); // introspection: white ring's area is the share of recent notes in the tracked cluster
+      }
+    }
+    return;
+  }
+  for (const auto& cluster : clusterMeans()) {
+    float x = cluster[0]; float y = cluster[1];
+    if (clusterCentres.add(x, y, sameClusterToleranceParameter)) {
+      commands.push_back(IntrospectorCircle { { x, y }, 20.0f*1.0f/Constants::WINDOW_WIDTH, ofColor::red, true, 100 }); // introspection: large red circle is new cluster centre
+    }
+  }
+}
+
+// Make fine structure from some recent notes
+void BellsEngine::makeFineStructure(const ofFloatColor& somColor) {
+  const auto& recentNoteXYs = noteHistory.getXYs();
+  if (recentNoteXYs.size() <= 70 || clusterMeans().empty()) return;
+
+  if (!clusterMiniBatchParameter) sortNotesByCluster();
+
+  // find some number of note clusters
+  std::vector<uint32_t> sameClusterNoteIds; // collect note IDs all from the same cluster
+  for (int i = 0; i < sampleNoteClustersParameter; i++) {
+    sampleSameClusterNotes(sameClusterNoteIds);
+
+    // if we found enough related notes then draw something
+    if (sameClusterNoteIds.size() <= 2) continue;
+
+    // path from notes in normalised coords, and its bounds
+    std::vector<glm::vec2> path;
+    glm::vec2 boundsMin { std::numeric_limits<float>::max() };
+    glm::vec2 boundsMax { std::numeric_limits<float>::lowest() };
+    for (uint32_t id : sameClusterNoteIds) {
+      const auto& note = recentNoteXYs[id];
+      path.push_back({ note[0], note[1] });
+      boundsMin = glm::min(boundsMin, path.back());
+      boundsMax = glm::max(boundsMax, path.back());
+    }
+    glm::vec2 boundsSize = boundsMax - boundsMin;
+
+    // scale up to some limit to fill mask with a reduced view of some part of the frozen fluid
+    constexpr float MAX_SCALE = 2.0;
+    float scaleX = std::fminf(MAX_SCALE, 1.0 / boundsSize.x);
+    float scaleY = std::fminf(MAX_SCALE, 1.0 / boundsSize.y);
+    float scale = std::fminf(scaleX, scaleY);
+
+    // paint path into the fluid layer
+    ofFloatColor fillColor = somColor;
+    fillColor.a = 0.3;
+    commands.push_back(Polygon { Layer::Fluid, OF_BLENDMODE_ALPHA, fillColor, path });
+
+    // a reduced SOM-tinted version of the frozen fluid into the crystal layer through the path
+    commands.push_back(Crystal { path, boundsMin + boundsSize / 2.0f, scale });
+
+    // extended outlines in the divisions layer, saved for redrawing into fluid
+    std::vector<LineSegment> extendedLines;
+    for(auto iter = sameClusterNoteIds.begin(); iter < sameClusterNoteIds.end(); iter++) {
+      auto id1 = *iter;
+      const auto& note1 = recentNoteXYs[id1];
+      float x1 = note1[0]; float y1 = note1[1];
+      uint32_t id2;
+      if (iter == sameClusterNoteIds.end() - 1) {
+        id2 = *sameClusterNoteIds.begin();
+      } else {
+        id2 = *(iter + 1);
+      }
+      const auto& note2 = recentNoteXYs[id2];
+      float x2 = note2[0]; float y2 = note2[1];
+      if (note1 == note2) continue;
+      DividerLine line = dividedArea.createConstrainedDividerLine({x1, y1}, {x2, y2});
+      extendedLines.push_back({ line.start, line.end });
+    }
+    commands.push_back(Lines { Layer::Divisions, OF_BLENDMODE_ALPHA, ofFloatColor(0.0, 0.0, 0.0, 1.0), 8.0f / Constants::CANVAS_WIDTH, false, extendedLines });
+
+    // plot connected clustered notes
+    {
+      uint32_t lastNoteId = *(sameClusterNoteIds.end() - 1);
+      auto lastNote = recentNoteXYs[lastNoteId];
+      for (uint32_t id : sameClusterNoteIds) {
+        const auto& note = recentNoteXYs[id];
+        commands.push_back(PlotLine { { lastNote[0], lastNote[1] }, { note[0], note[1] }, ofColor::red, 50 });
+        lastNote = note;
+      }
+    }
+
+    // plot extended lines
+    for (const auto& line : extendedLines) {
+      commands.push_back(PlotLine { line.start, line.end, ofColor::green, 20 });
+    }
+
+    // redraw extended lines into the fluid layer
+    commands.push_back(Lines { Layer::Fluid, OF_BLENDMODE_ALPHA, ofFloatColor(0.0, 0.0, 0.0, 0.3), 1.0f / Constants::FLUID_WIDTH, false, std::move(extendedLines) });
+  }
+}
+
+// Counting sort of the note slots by cluster, so each cluster's notes are together in clusterNotes
+// from clusterNoteStarts[cluster]
+void BellsEngine::sortNotesByCluster() {
+  const auto& labels = noteClusters.clusters();
+  size_t clusterCount = clusterMeans().size();
+  clusterNoteStarts.assign(clusterCount + 1, 0);
+  for (uint32_t label : labels) clusterNoteStarts[label + 1]++;
+  for (size_t cluster = 0; cluster < clusterCount; cluster++) clusterNoteStarts[cluster + 1] += clusterNoteStarts[cluster];
+  clusterNotes.resize(labels.size());
+  for (uint32_t slot = 0; slot < labels.size(); slot++) {
+    clusterNotes[clusterNoteStarts[labels[slot]]++] = slot;
+  }
+  // each start has been moved on to the next one's
+  for (size_t cluster = clusterCount; cluster > 0; cluster--) clusterNoteStarts[cluster] = clusterNoteStarts[cluster - 1];
+  clusterNoteStarts[0] = 0;
+}
+
+// The cluster of a random note, so clusters come up in proportion to their notes, and up to
+// sampleNotes + 1 different notes from it
+void BellsEngine::sampleSameClusterNotes(std::vector<uint32_t>& noteIds) {
+  noteIds.clear();
+  size_t noteCount = noteHistory.size();
+  size_t id = randomIndex(noteCount);
+  uint32_t clusterId = noteClusterId(id);
+
+  if (clusterMiniBatchParameter) {
+    // mini-batch clustering only labels the notes asked about, so pick a number of additional
+    // random notes and keep if from this cluster
+    noteIds.push_back(id);
+    for (int i = 0; i < sampleNotesParameter; i++) {
+      id = randomIndex(noteCount);
+      if (noteClusterId(id) == clusterId) noteIds.push_back(id);
+    }
+    return;
+  }
+
+  // a partial Fisher-Yates shuffle of the cluster's notes leaves the sample at the front
+  uint32_t* bucket = &clusterNotes[clusterNoteStarts[clusterId]];
+  size_t bucketSize = clusterNoteStarts[clusterId + 1] - clusterNoteStarts[clusterId];
+  size_t sampleSize = std::min<size_t>(bucketSize, sampleNotesParameter + 1);
+  for (size_t i = 0; i < sampleSize; i++) {
+    std::swap(bucket[i], bucket[i + randomIndex(bucketSize - i)]);
+    noteIds.push_back(bucket[i]);
+  }
+}
+
+std::vector<LineSegment> BellsEngine::divisionSegments() const {
+  std::vector<LineSegment> segments;
+  segments.reserve(dividedArea.unconstrainedDividerLines.size());
+  for (const auto& line : dividedArea.unconstrainedDividerLines) {
+    segments.push_back({ line.start, line.end });
+  }
+  return segments;
+}
+
+// age all clusterCentres and delete the decayed ones
+void BellsEngine::decayClusterCentres() {
+  auto visit = [this](const glm::vec4& p) {
+    if (p.w > 5.0) {
+      commands.push_back(IntrospectorCircle { { p.x, p.y }, 10.0f*1.0f/Constants::WINDOW_WIDTH, ofColor::lightGreen, true, 60 }); // large lightGreen circle is long-lived clusterCentre
+    } else {
+      commands.push_back(IntrospectorCircle { { p.x, p.y }, 6.0f*1.0f/Constants::WINDOW_WIDTH, ofColor::darkOrange, true, 30 }); // small darkOrange circle is short-lived clusterCentre
+    }
+  };
+  if (clusterTracked) {
+    clusterTracker.decay(clusterDecayRateParameter, visit);
+  } else {
+    clusterCentres.decay(clusterDecayRateParameter, visit);
+  }
+}
+
+const std::vector<std::array<float, 2>>& BellsEngine::clusterMeans() const {
+  return clusterMiniBatchParameter ? miniBatchNoteClusters.means() : noteClusters.means();
+}
+
+// mini-batch clustering only labels the notes that are asked about
+uint32_t BellsEngine::noteClusterId(size_t slot) {
+  if (clusterMiniBatchParameter) return miniBatchNoteClusters.label(noteHistory.getXYs(), slot);
+  return noteClusters.clusters()[slot];
+}
+
+// mini-batch clustering only counts its last batch, so scale that up to the whole history
+const std::vector<size_t>& BellsEngine::clusterNoteCounts() {
+  if (!clusterMiniBatchParameter) return noteClusters.counts();
+  const auto& batchCounts = miniBatchNoteClusters.batch_counts();
+  size_t batchSize = miniBatchNoteClusters.get_parameters().get_batch_size();
+  miniBatchNoteCounts.resize(batchCounts.size());
+  for (size_t i = 0; i < batchCounts.size(); i++) {
+    miniBatchNoteCounts[i] = batchCounts[i] * noteHistory.size() / batchSize;
+  }
+  return miniBatchNoteCounts;
+}
+
+ofFloatColor BellsEngine::somColorAt(float x, float y) const {
+  SomColorTable::Color c = somColors->colorAt(x, y);
+  return ofFloatColor(c[0], c[1], c[2], c[3]);
+}
+
+void BellsEngine::somColorsAt(const std::vector<std::array<float, 2>>& points, std::vector<ofFloatColor>& colors) {
+  somColorsScratch.resize(points.size());
+  somColors->colorsAt(points.data(), points.size(), somColorsScratch.data());
+  colors.resize(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    const auto& c = somColorsScratch[i];
+    colors[i] = ofFloatColor(c[0], c[1], c[2], c[3]);
+  }
+}
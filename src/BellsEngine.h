@@ -0,0 +1,111 @@
+#pragma once
+
+#include <random>
+#include <vector>
+#include "ofParameter.h"
+#include "ofxDividedArea.h"
+#include "ClusterCentres.h"
+#include "ClusterTracker.h"
+#include "dkm_parallel.hpp"
+#include "DrawCommand.h"
+#include "NoteHistory.h"
+#include "SomTrainer.h"
+#include "Xoshiro256.h"
+
+// One frame of audio features, normalised to [0, 1] by the caller
+struct AudioFrame {
+  float s; // pitch
+  float t; // RMS
+  float u; // spectral kurtosis
+  float v; // spectral centroid
+  bool valid; // a note is sounding
+  float time; // seconds since the start
+};
+
+// Everything bells does with the audio that doesn't need a GPU: the SOM, the note history and its
+// clustering, the cluster centres and divided area, and choosing what to draw. update() turns a
+// frame of audio features into the frame's DrawCommands, so the engine can run without a window,
+// and with a fixed seed and somAsync off the same frames always give the same commands.
+class BellsEngine {
+
+public:
+  void setup(uint64_t seed = std::random_device()());
+
+  const std::vector<DrawCommand>& update(const AudioFrame& frame);
+
+  ofParameterGroup& getClusterParameters() { return clusterParameters; }
+  ofParameterGroup& getSomParameters() { return somParameters; }
+  ofParameterGroup& getImpulseParameters() { return impulseParameters; }
+
+  DividedArea& getDividedArea() { return dividedArea; }
+  const std::vector<glm::vec4>& getClusterCentres() const { return clusterTracked ? clusterTracker.getCentres() : clusterCentres.getCentres(); }
+  const SomTrainer& getSomTrainer() const { return somTrainer; }
+  const dkm::kmeans_statistics& getClusterStatistics() const { return clusterStatistics; }
+
+private:
+  Xoshiro256 randomEngine;
+  size_t randomIndex(size_t count);
+  float randomUniform();
+
+  std::vector<DrawCommand> commands;
+
+  SomTrainer somTrainer;
+  std::shared_ptr<const SomColorTable> somColors; // latest published SOM snapshot, taken at the start of each update
+  ofFloatColor somColorAt(float x, float y) const;
+  void somColorsAt(const std::vector<std::array<float, 2>>& points, std::vector<ofFloatColor>& colors);
+  std::vector<SomColorTable::Color> somColorsScratch;
+  std::vector<std::array<float, 2>> arcCentres;
+  std::vector<ofFloatColor> arcColors;
+  std::vector<ofFloatColor> impulseColors;
+
+  DividedArea dividedArea { {1.0, 1.0}, 7 };
+
+  NoteHistory noteHistory { 3000 }; // resized to clusterSourceSamplesMax in update()
+  dkm::thread_pool clusterThreadPool { 1 }; // resized to clusterThreads in update()
+  dkm::kmeans_statistics clusterStatistics; // totals for clusterAccelerated refinement
+  dkm::kmeans_state<float, 2> noteClusters { dkm::clustering_parameters<float>(1) }; // warm-started clustering of noteHistory slots, reseeded whenever clusterCentres or the history capacity changes
+  dkm::kmeans_minibatch_state<float, 2> miniBatchNoteClusters { dkm::minibatch_parameters<float>(1) }; // used instead of noteClusters when clusterMiniBatch is set, for long histories
+  const std::vector<std::array<float, 2>>& clusterMeans() const;
+  uint32_t noteClusterId(size_t slot);
+  const std::vector<size_t>& clusterNoteCounts(); // notes in each cluster
+  std::vector<size_t> miniBatchNoteCounts;
+  ClusterCentres clusterCentres;
+  ClusterTracker clusterTracker; // used instead of clusterCentres when clusterTracked is set
+  bool clusterTracked { false };
+
+  void addNote(const AudioFrame& frame);
+  void updateClusters();
+  void updateClusterCentres();
+  void makeFineStructure(const ofFloatColor& somColor);
+  std::vector<uint32_t> clusterNotes; // note slots by cluster, from the last clustering
+  std::vector<uint32_t> clusterNoteStarts; // where each cluster's notes start in clusterNotes, and the end
+  void sortNotesByCluster();
+  void sampleSameClusterNotes(std::vector<uint32_t>& noteIds);
+  void decayClusterCentres();
+  std::vector<DrawCommands::LineSegment> divisionSegments() const;
+
+  ofParameterGroup clusterParameters { "cluster" };
+  ofParameter<int> clusterCentresParameter { "clusterCentres", 12, 2.0, 50.0 };
+  ofParameter<int> clusterSourceSamplesMaxParameter { "clusterSourceSamplesMax", 3000, 1000, 100000 }; // Note: 1600 raw samples per frame at 30fps. Use clusterMiniBatch above ~8000
+  ofParameter<int> clusterRefineIterationsParameter { "clusterRefineIterations", 2, 1, 20 }; // Lloyd iterations per frame, warm-started from the previous means
+  ofParameter<int> clusterThreadsParameter { "clusterThreads", 1, 1, 16 }; // threads sharing each Lloyd iteration, including the render thread
+  ofParameter<bool> clusterAcceleratedParameter { "clusterAccelerated", true }; // single-threaded Lloyd with Hamerly bounds, same result with fewer distance evaluations
+  ofParameter<bool> clusterMiniBatchParameter { "clusterMiniBatch", false }; // mini-batch k-means: constant cost per frame whatever the history size
+  ofParameter<int> clusterBatchSizeParameter { "clusterBatchSize", 256, 32, 4096 }; // notes sampled per mini-batch; clusterRefineIterations batches run per frame
+  ofParameter<float> clusterMinLearningRateParameter { "clusterMinLearningRate", 0.01, 0.0, 0.2 }; // keeps mini-batch means following the history as it changes
+  ofParameter<float> clusterDecayRateParameter { "clusterDecayRate", 1.1, 0.0, 5.0 };
+  ofParameter<float> sameClusterToleranceParameter { "sameClusterTolerance", 0.1, 0.01, 1.0 };
+  ofParameter<bool> clusterTrackedParameter { "clusterTracked", false }; // follow each cluster with one centre, assigned one-to-one each frame, rather than matching within sameClusterTolerance
+  ofParameter<int> sampleNoteClustersParameter { "sampleNoteClusters", 7, 1, 20 };
+  ofParameter<int> sampleNotesParameter { "sampleNotes", 7, 1, 20 };
+
+  ofParameterGroup somParameters { "som" };
+  ofParameter<int> somThreadsParameter { "somThreads", 1, 1, 16 }; // threads sharing the best-matching-unit search and large neighbourhood updates
+  ofParameter<float> somNeighbourhoodCutoffParameter { "somNeighbourhoodCutoff", 0.0, 0.0, 0.01 }; // skip SOM nodes that would change by less than this
+  ofParameter<bool> somAsyncParameter { "somAsync", true }; // train on a separate thread; off trains each note in the frame it arrives
+  ofParameter<int> somPublishIntervalParameter { "somPublishInterval", 4, 1, 64 }; // most SOM updates between colour snapshots while a burst of notes is trained
+
+  ofParameterGroup impulseParameters { "impulse" };
+  ofParameter<float> impulseRadiusParameter { "impulseRadius", 0.085, 0.01, 0.2 };
+  ofParameter<float> impulseRadialVelocityParameter { "impulseRadialVelocity", 0.0003, 0.0001, 0.001 };
+};
@@ -0,0 +1,81 @@
+#include "ClusterCentres.h"
+#include <cmath>
+
+bool ClusterCentres::add(float x, float y, float tolerance) {
+  // a little larger than the tolerance so rounding can't put a match two cells away
+  double size = tolerance * 1.0001;
+  if (cellSize != size) {
+    cellSize = size;
+    reindex();
+  }
+
+  uint32_t match = findMatch(x, y, tolerance);
+  if (match != NONE) {
+    centres[match].w++; // existing cluster so add to its age to preserve it
+    return false;
+  }
+
+  centres.push_back(glm::vec4(x, y, 0.0, 1.0)); // start at age=1
+  nextInCell.push_back(NONE);
+  if ((cellCount + 1) * 2 > cells.size()) {
+    reindex();
+  } else {
+    index(centres.size() - 1);
+  }
+  return true;
+}
+
+int32_t ClusterCentres::cellCoordinate(float v) const {
+  return static_cast<int32_t>(std::floor(v / cellSize));
+}
+
+size_t ClusterCentres::findSlot(int32_t column, int32_t row) const {
+  uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(column)) << 32) | static_cast<uint32_t>(row);
+  key *= 0x9E3779B97F4A7C15ull;
+  size_t mask = cells.size() - 1;
+  for (size_t slot = (key >> 32) & mask;; slot = (slot + 1) & mask) {
+    const Cell& cell = cells[slot];
+    if (cell.head == NONE || (cell.column == column && cell.row == row)) return slot;
+  }
+}
+
+// Centres are in the order they were made, so the lowest matching index is the one a scan from the
+// start would have found first
+uint32_t ClusterCentres::findMatch(float x, float y, float tolerance) const {
+  if (centres.empty()) return NONE;
+  int32_t column = cellCoordinate(x);
+  int32_t row = cellCoordinate(y);
+  uint32_t match = NONE;
+  for (int32_t r = row - 1; r <= row + 1; r++) {
+    for (int32_t c = column - 1; c <= column + 1; c++) {
+      for (uint32_t i = cells[findSlot(c, r)].head; i != NONE; i = nextInCell[i]) {
+        const glm::vec4& p = centres[i];
+        if (i < match && std::abs(p.x - x) < tolerance && std::abs(p.y - y) < tolerance) match = i;
+      }
+    }
+  }
+  return match;
+}
+
+void ClusterCentres::index(uint32_t i) {
+  int32_t column = cellCoordinate(centres[i].x);
+  int32_t row = cellCoordinate(centres[i].y);
+  Cell& cell = cells[findSlot(column, row)];
+  if (cell.head == NONE) {
+    cell.column = column;
+    cell.row = row;
+    cellCount++;
+  }
+  nextInCell[i] = cell.head;
+  cell.head = i;
+}
+
+// Room for every centre and the next in its own cell at no more than half full
+void ClusterCentres::reindex() {
+  size_t slots = 16;
+  while (slots < (centres.size() + 1) * 2) slots *= 2;
+  cells.assign(slots, { 0, 0, NONE });
+  cellCount = 0;
+  nextInCell.assign(centres.size(), NONE);
+  for (uint32_t i = 0; i < centres.size(); i++) index(i);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm/vec4.hpp"
+
+// Cluster centres that outlive the clusters they came from, each aged up whenever a new cluster
+// mean lands on it and down every frame. Centres are kept contiguous in the order they were made,
+// as DividedArea takes them, with w as the age.
+//
+// A mean matches the first centre within tolerance of it on both axes. Centres are also indexed in
+// a hash of tolerance-sized cells, so only the centres in the 3x3 cells around a mean are tested
+// rather than all of them. decay() ages, visits and removes centres in a single pass, and the index
+// is only rebuilt when a centre was removed.
+class ClusterCentres {
+
+public:
+  // Returns true if the mean made a new centre
+  bool add(float x, float y, float tolerance);
+
+  // Takes rate off every age and visits each centre after that, including the ones it then removes
+  // for having no age left
+  template <typename F>
+  void decay(float rate, F&& visit);
+
+  const std::vector<glm::vec4>& getCentres() const { return centres; }
+  size_t size() const { return centres.size(); }
+  bool empty() const { return centres.empty(); }
+
+private:
+  static constexpr uint32_t NONE = UINT32_MAX;
+
+  std::vector<glm::vec4> centres;
+  std::vector<uint32_t> nextInCell; // chains centres in the same cell, indexed like centres
+
+  // open addressed table of cells, each with the last centre added to it
+  struct Cell {
+    int32_t column, row;
+    uint32_t head; // NONE if the slot is free
+  };
+  std::vector<Cell> cells;
+  size_t cellCount { 0 };
+  double cellSize { 0.0 };
+
+  int32_t cellCoordinate(float v) const;
+  size_t findSlot(int32_t column, int32_t row) const; // the cell's slot, or the free one it would go in
+  uint32_t findMatch(float x, float y, float tolerance) const;
+  void index(uint32_t i);
+  void reindex();
+};
+
+template <typename F>
+void ClusterCentres::decay(float rate, F&& visit) {
+  size_t kept = 0;
+  for (size_t i = 0; i < centres.size(); i++) {
+    glm::vec4& p = centres[i];
+    p.w -= rate;
+    visit(p);
+    if (p.w <= 0) continue;
+    centres[kept++] = p;
+  }
+  if (kept == centres.size()) return; // nothing moved, so the index still holds
+  centres.resize(kept);
+  reindex();
+}
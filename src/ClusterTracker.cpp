@@ -0,0 +1,121 @@
+#include "ClusterTracker.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr double FORBIDDEN = 1.0e6; // far more than any allowed assignment costs in total
+
+}
+
+const std::vector<size_t>& ClusterTracker::update(const std::vector<std::array<float, 2>>& means, float tolerance) {
+  size_t meanCount = means.size();
+  size_t trackCount = centres.size();
+
+  // Means are rows; the columns are the tracks and then a column per mean for starting a new track,
+  // which costs as much as the furthest allowed assignment
+  size_t columns = trackCount + meanCount;
+  double maxCost = tolerance * tolerance;
+  costs.resize(meanCount * columns);
+  for (size_t i = 0; i < meanCount; i++) {
+    double* row = &costs[i * columns];
+    for (size_t j = 0; j < trackCount; j++) {
+      const glm::vec4& p = centres[j];
+      double dx = means[i][0] - (p.x + velocities[j].x);
+      double dy = means[i][1] - (p.y + velocities[j].y);
+      double cost = dx * dx + dy * dy;
+      row[j] = cost < maxCost ? cost : FORBIDDEN;
+    }
+    for (size_t j = 0; j < meanCount; j++) {
+      row[trackCount + j] = (i == j) ? maxCost : FORBIDDEN;
+    }
+  }
+  assign(meanCount, columns);
+
+  meanTracks.assign(meanCount, NONE);
+  for (size_t j = 0; j < trackCount; j++) {
+    if (columnRows[j + 1] != 0) meanTracks[columnRows[j + 1] - 1] = j;
+  }
+
+  births.clear();
+  for (size_t i = 0; i < meanCount; i++) {
+    float x = means[i][0]; float y = means[i][1];
+    size_t track = meanTracks[i];
+    if (track == NONE) {
+      meanTracks[i] = centres.size();
+      births.push_back(i);
+      centres.push_back(glm::vec4(x, y, 0.0, 1.0)); // start at age=1
+      velocities.push_back({ 0.0, 0.0 });
+      notes.push_back(0);
+    } else {
+      glm::vec4& p = centres[track];
+      glm::vec2& velocity = velocities[track];
+      velocity.x += VELOCITY_SMOOTHING * ((x - p.x) - velocity.x);
+      velocity.y += VELOCITY_SMOOTHING * ((y - p.y) - velocity.y);
+      p.x = x;
+      p.y = y;
+      p.w++; // the cluster is still there so add to its age to preserve it
+    }
+  }
+  return births;
+}
+
+void ClusterTracker::countNotes(const std::vector<size_t>& meanCounts) {
+  std::fill(notes.begin(), notes.end(), 0);
+  for (size_t mean = 0; mean < meanTracks.size() && mean < meanCounts.size(); mean++) {
+    notes[meanTracks[mean]] = meanCounts[mean];
+  }
+}
+
+// Minimum cost assignment of every row to a different column, rows <= columns, by shortest
+// augmenting paths with row and column potentials: O(rows^2 columns). Indices are from 1 so that
+// column 0 can stand for the row being added; columnRows[j] is the row in column j, or 0.
+void ClusterTracker::assign(size_t rows, size_t columns) {
+  const double INF = std::numeric_limits<double>::infinity();
+  rowPotentials.assign(rows + 1, 0.0);
+  columnPotentials.assign(columns + 1, 0.0);
+  columnRows.assign(columns + 1, 0);
+  columnWays.assign(columns + 1, 0);
+
+  for (size_t row = 1; row <= rows; row++) {
+    columnRows[0] = row;
+    size_t column = 0;
+    minima.assign(columns + 1, INF);
+    visited.assign(columns + 1, false);
+    do {
+      visited[column] = true;
+      size_t currentRow = columnRows[column];
+      const double* rowCosts = &costs[(currentRow - 1) * columns];
+      double delta = INF;
+      size_t nextColumn = 0;
+      for (size_t j = 1; j <= columns; j++) {
+        if (visited[j]) continue;
+        double reduced = rowCosts[j - 1] - rowPotentials[currentRow] - columnPotentials[j];
+        if (reduced < minima[j]) {
+          minima[j] = reduced;
+          columnWays[j] = column;
+        }
+        if (minima[j] < delta) {
+          delta = minima[j];
+          nextColumn = j;
+        }
+      }
+      for (size_t j = 0; j <= columns; j++) {
+        if (visited[j]) {
+          rowPotentials[columnRows[j]] += delta;
+          columnPotentials[j] -= delta;
+        } else {
+          minima[j] -= delta;
+        }
+      }
+      column = nextColumn;
+    } while (columnRows[column] != 0);
+
+    // flip the augmenting path back to column 0
+    do {
+      size_t previous = columnWays[column];
+      columnRows[column] = columnRows[previous];
+      column = previous;
+    } while (column != 0);
+  }
+}
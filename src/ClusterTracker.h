@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm/vec2.hpp"
+#include "glm/vec4.hpp"
+
+// Cluster centres that follow the k-means clusters from frame to frame, as an alternative to
+// ClusterCentres' tolerance box, which lets two means land on one centre and a mean that has moved
+// a little make a duplicate.
+//
+// Each frame the new means are assigned one-to-one to the tracks, minimising the total squared
+// distance from each track's predicted position, with pairs further apart than the tolerance not
+// allowed. A mean left unassigned starts a new track. Tracks have a smoothed velocity, the number
+// of notes now in them, and an age kept as ClusterCentres keeps it: up one each frame a mean is
+// assigned and down by the decay rate every frame, in w of getCentres().
+class ClusterTracker {
+
+public:
+  // Returns the indices of the means that started new tracks
+  const std::vector<size_t>& update(const std::vector<std::array<float, 2>>& means, float tolerance);
+
+  // Takes each track's note count from the number of notes in the mean it was assigned in the last
+  // update, as k-means keeps them, so it's O(k) rather than a pass over the labels
+  void countNotes(const std::vector<size_t>& meanCounts);
+
+  // As ClusterCentres::decay
+  template <typename F>
+  void decay(float rate, F&& visit);
+
+  const std::vector<glm::vec4>& getCentres() const { return centres; } // w is age
+  size_t size() const { return centres.size(); }
+  size_t getNotes(size_t track) const { return notes[track]; }
+
+private:
+  static constexpr size_t NONE = SIZE_MAX;
+  static constexpr float VELOCITY_SMOOTHING = 0.5; // weight of the latest movement
+
+  // per track, all in the same order
+  std::vector<glm::vec4> centres;
+  std::vector<glm::vec2> velocities;
+  std::vector<size_t> notes;
+
+  std::vector<size_t> meanTracks; // track assigned to each mean in the last update
+  std::vector<size_t> births;
+
+  // assignment scratch
+  std::vector<double> costs, rowPotentials, columnPotentials, minima;
+  std::vector<size_t> columnRows, columnWays;
+  std::vector<bool> visited;
+  void assign(size_t rows, size_t columns);
+};
+
+template <typename F>
+void ClusterTracker::decay(float rate, F&& visit) {
+  size_t kept = 0;
+  for (size_t i = 0; i < centres.size(); i++) {
+    glm::vec4& p = centres[i];
+    p.w -= rate;
+    visit(p);
+    if (p.w <= 0) continue;
+    centres[kept] = p;
+    velocities[kept] = velocities[i];
+    notes[kept] = notes[i];
+    kept++;
+  }
+  centres.resize(kept);
+  velocities.resize(kept);
+  notes.resize(kept);
+  meanTracks.clear(); // tracks have moved
+}
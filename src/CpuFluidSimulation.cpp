@@ -0,0 +1,146 @@
+#include "CpuFluidSimulation.h"
+#include "StageProfiler.h"
+
+namespace {
+
+// covers antialiasing and outline strokes past the bounds of what was drawn
+constexpr int MARGIN_CELLS = 2;
+
+}
+
+void CpuFluidSimulation::setup(glm::vec2 size_) {
+  size = size_;
+  parameters.add(dtParameter);
+  parameters.add(vorticityParameter);
+  parameters.add(valueDissipationParameter);
+  parameters.add(velocityDissipationParameter);
+  parameters.add(temperatureDissipationParameter);
+  parameters.add(pressureIterationsParameter);
+  parameters.add(multigridParameter);
+  parameters.add(targetResidualParameter);
+  parameters.add(maxCyclesParameter);
+  parameters.add(budgetParameter);
+  parameters.add(gridScaleParameter);
+  parameters.add(threadsParameter);
+  buoyancyParameters.add(ambientTemperatureParameter);
+  buoyancyParameters.add(buoyancyParameter);
+  buoyancyParameters.add(weightParameter);
+  buoyancyParameters.add(gravityForceXParameter);
+  buoyancyParameters.add(gravityForceYParameter);
+  parameters.add(buoyancyParameters);
+  threadsParameter = std::min(16u, std::max(1u, std::thread::hardware_concurrency()));
+  allocate();
+}
+
+// Starts the fluid again at the new size
+void CpuFluidSimulation::allocate() {
+  gridScale = gridScaleParameter;
+  size_t width = std::max(1, static_cast<int>(std::round(size.x * gridScale)));
+  size_t height = std::max(1, static_cast<int>(std::round(size.y * gridScale)));
+  solver.setup(width, height);
+  flowValues.fbo.allocate(width, height, GL_RGBA32F);
+  flowValues.fbo.begin();
+  ofClear(0, 0);
+  flowValues.fbo.end();
+  pixels.allocate(width, height, OF_PIXELS_RGBA);
+  pixels.set(0.0f);
+  impulses.clear();
+  valuesDrawn = false;
+}
+
+void CpuFluidSimulation::markValuesDrawn(glm::vec2 min, glm::vec2 max) {
+  if (valuesDrawn) {
+    drawnMin = glm::min(drawnMin, min);
+    drawnMax = glm::max(drawnMax, max);
+  } else {
+    drawnMin = min;
+    drawnMax = max;
+    valuesDrawn = true;
+  }
+}
+
+// Just the drawn cells, from the fbo into pixels and the solver. Fbo rows are in the same order as
+// the pixels'.
+void CpuFluidSimulation::readBackDrawn() {
+  int width = solver.getWidth();
+  int height = solver.getHeight();
+  int x0 = std::max(0, static_cast<int>(std::floor(drawnMin.x * width)) - MARGIN_CELLS);
+  int y0 = std::max(0, static_cast<int>(std::floor(drawnMin.y * height)) - MARGIN_CELLS);
+  int x1 = std::min(width, static_cast<int>(std::ceil(drawnMax.x * width)) + MARGIN_CELLS);
+  int y1 = std::min(height, static_cast<int>(std::ceil(drawnMax.y * height)) + MARGIN_CELLS);
+  valuesDrawn = false;
+  if (x0 >= x1 || y0 >= y1) return;
+
+  float* rgba = pixels.getData();
+  flowValues.fbo.bind();
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glPixelStorei(GL_PACK_ROW_LENGTH, width);
+  glReadPixels(x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_FLOAT, rgba + (size_t(y0) * width + x0) * 4);
+  glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  flowValues.fbo.unbind();
+
+  for (size_t channel = 0; channel < CpuFluidSolver::VALUE_CHANNELS; channel++) {
+    float* plane = solver.getValues(channel);
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        size_t i = size_t(y) * width + x;
+        plane[i] = rgba[i * 4 + channel];
+      }
+    }
+  }
+}
+
+void CpuFluidSimulation::applyImpulse(const Impulse& impulse) {
+  float scale = solver.getWidth() / size.x; // cells per pixel
+  float cellsPerWidth = solver.getWidth();
+  impulses.push_back({
+    impulse.position.x * scale - 0.5f, impulse.position.y * scale - 0.5f,
+    impulse.radius * scale,
+    impulse.velocity.x * cellsPerWidth, impulse.velocity.y * cellsPerWidth,
+    impulse.radialVelocity * cellsPerWidth,
+    { impulse.color.r, impulse.color.g, impulse.color.b, impulse.color.a },
+    impulse.temperature
+  });
+}
+
+void CpuFluidSimulation::update() {
+  if (gridScale != gridScaleParameter) allocate();
+  solver.setThreadCount(threadsParameter);
+  size_t cells = solver.getWidth() * solver.getHeight();
+
+  if (valuesDrawn) {
+    PROFILE_STAGE("fluid-readback");
+    readBackDrawn();
+  }
+
+  for (const auto& impulse : impulses) solver.applyImpulse(impulse);
+  impulses.clear();
+
+  CpuFluidSolver::Parameters stepParameters;
+  stepParameters.dt = dtParameter;
+  stepParameters.vorticity = vorticityParameter;
+  stepParameters.valueDissipation = valueDissipationParameter;
+  stepParameters.velocityDissipation = velocityDissipationParameter;
+  stepParameters.temperatureDissipation = temperatureDissipationParameter;
+  stepParameters.buoyancy = buoyancyParameter;
+  stepParameters.weight = weightParameter;
+  stepParameters.ambientTemperature = ambientTemperatureParameter;
+  stepParameters.gravityX = gravityForceXParameter;
+  stepParameters.gravityY = gravityForceYParameter;
+  stepParameters.pressureIterations = pressureIterationsParameter;
+  stepParameters.multigrid = multigridParameter;
+  stepParameters.targetResidual = targetResidualParameter;
+  stepParameters.maxCycles = maxCyclesParameter;
+  stepParameters.budgetMillis = budgetParameter;
+  solver.step(stepParameters);
+
+  {
+    PROFILE_STAGE("fluid-upload");
+    float* rgba = pixels.getData();
+    for (size_t channel = 0; channel < CpuFluidSolver::VALUE_CHANNELS; channel++) {
+      const float* plane = solver.getValues(channel);
+      for (size_t i = 0; i < cells; i++) rgba[i * 4 + channel] = plane[i];
+    }
+    flowValues.fbo.getTexture().loadData(pixels);
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ofMain.h"
+#include "CpuFluidSolver.h"
+
+// CpuFluidSolver behind the parts of the FluidSimulation addon's interface that the app uses, with
+// the same parameter group and names, for building with BELLS_CPU_FLUID defined on machines whose
+// GPU can't run the fluid shaders at the canvas size.
+//
+// The flow values fbo is at the solver's (reduced) grid size rather than the full fluid size, so
+// what's drawn into it is read back exactly: each update reads what was drawn into the fbo into
+// the solver, applies the frame's impulses, steps and uploads the values again. The readback
+// stalls on the GPU, so it only covers the bounds given to markValuesDrawn() since the last update,
+// and is skipped when there are none; everything else in the fbo is still as uploaded. The layers
+// and crystals only ever use it in normalised coordinates and it's scaled up when drawn.
+class CpuFluidSimulation {
+
+public:
+  // As FluidSimulation::Impulse: position and radius in pixels of the size given to setup(),
+  // velocities as fractions of its width per unit time
+  struct Impulse {
+    glm::vec2 position;
+    float radius;
+    glm::vec2 velocity;
+    float radialVelocity;
+    ofFloatColor color;
+    float temperature;
+  };
+
+  class FlowValues {
+  public:
+    ofFbo& getSource() { return fbo; }
+    const ofFbo& getSource() const { return fbo; }
+  private:
+    friend class CpuFluidSimulation;
+    ofFbo fbo;
+  };
+
+  void setup(glm::vec2 size);
+  void update();
+  void applyImpulse(const Impulse& impulse); // at the next update, after what's been drawn
+  void markValuesDrawn(glm::vec2 min, glm::vec2 max); // normalised bounds of a draw into the flow values fbo
+
+  ofParameterGroup& getParameterGroup() { return parameters; }
+  FlowValues& getFlowValuesFbo() { return flowValues; }
+  const CpuFluidSolver& getSolver() const { return solver; } // for its last pressure residual
+
+private:
+  glm::vec2 size;
+  float gridScale { 0.0 }; // as allocated
+  CpuFluidSolver solver;
+  FlowValues flowValues;
+  ofFloatPixels pixels; // as last uploaded, and then with what's drawn read back over it
+  std::vector<CpuFluidSolver::Impulse> impulses;
+  bool valuesDrawn { false };
+  glm::vec2 drawnMin, drawnMax; // normalised, since the last update
+
+  void allocate();
+  void readBackDrawn();
+
+  ofParameterGroup parameters { "Fluid_Simulation" };
+  ofParameter<float> dtParameter { "dt", 0.02, 0.001, 0.1 };
+  ofParameter<float> vorticityParameter { "vorticity", 15.0, 0.0, 50.0 };
+  ofParameter<float> valueDissipationParameter { "value:dissipation", 0.9975, 0.9, 1.0 };
+  ofParameter<float> velocityDissipationParameter { "velocity:dissipation", 0.9999, 0.9, 1.0 };
+  ofParameter<float> temperatureDissipationParameter { "temperature:dissipation", 0.99, 0.9, 1.0 };
+  ofParameterGroup buoyancyParameters { "Bouyancy" }; // spelt as in the addon and the saved settings
+  ofParameter<float> ambientTemperatureParameter { "ambientTemperature", 0.0, -1.0, 1.0 };
+  ofParameter<float> buoyancyParameter { "smokeBouyancy", 1.0, 0.0, 10.0 };
+  ofParameter<float> weightParameter { "smokeWeight", 0.05, 0.0, 1.0 };
+  ofParameter<float> gravityForceXParameter { "gravityForceX", 0.0, -1.0, 1.0 };
+  ofParameter<float> gravityForceYParameter { "gravityForceY", -0.98, -1.0, 1.0 };
+  ofParameter<int> pressureIterationsParameter { "pressure:iterations", 22, 0, 100 };
+  ofParameter<bool> multigridParameter { "pressure:multigrid", false }; // V-cycles instead of the iterations
+  ofParameter<float> targetResidualParameter { "pressure:targetResidual", 0.01, 0.0001, 0.5 };
+  ofParameter<int> maxCyclesParameter { "pressure:maxCycles", 4, 1, 16 };
+  ofParameter<float> budgetParameter { "pressure:budgetMs", 0.0, 0.0, 50.0 }; // 0 for no limit
+  ofParameter<float> gridScaleParameter { "cpu:gridScale", 0.25, 0.0625, 1.0 }; // of the fluid size given to setup()
+  ofParameter<int> threadsParameter { "cpu:threads", 4, 1, 16 };
+};
@@ -0,0 +1,508 @@
+#include "CpuFluidSolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include "StageProfiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLUID_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FLUID_NEON 1
+#endif
+
+namespace {
+
+#if FLUID_SSE2
+#define FLUID_SIMD 1
+using Lanes = __m128;
+inline Lanes load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+inline Lanes splat(float v) { return _mm_set1_ps(v); }
+inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+inline Lanes divide(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+inline Lanes squareRoot(Lanes a) { return _mm_sqrt_ps(a); }
+inline Lanes absolute(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#elif FLUID_NEON
+#define FLUID_SIMD 1
+using Lanes = float32x4_t;
+inline Lanes load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, Lanes a) { vst1q_f32(p, a); }
+inline Lanes splat(float v) { return vdupq_n_f32(v); }
+inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+inline Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+inline Lanes divide(Lanes a, Lanes b) { return vdivq_f32(a, b); }
+inline Lanes squareRoot(Lanes a) { return vsqrtq_f32(a); }
+inline Lanes absolute(Lanes a) { return vabsq_f32(a); }
+#endif
+
+// The rows of a stencil's neighbours, clamped at the edges
+struct Rows {
+  size_t above, below;
+  Rows(size_t y, size_t height) : above { y > 0 ? y - 1 : 0 }, below { y + 1 < height ? y + 1 : height - 1 } {}
+};
+
+// out = ((a right - a left) + sign (b below - b above)) / 2: the divergence of (a, b) with sign 1,
+// or the curl of (b, a) with sign -1
+void centralDifferencesRow(const float* a, const float* bAbove, const float* bBelow, float sign, float* out, size_t width) {
+  if (width == 1) {
+    out[0] = 0.5f * sign * (bBelow[0] - bAbove[0]);
+    return;
+  }
+  out[0] = 0.5f * ((a[1] - a[0]) + sign * (bBelow[0] - bAbove[0]));
+  size_t x = 1;
+#if FLUID_SIMD
+  const Lanes half = splat(0.5f);
+  const Lanes signs = splat(sign);
+  for (; x + 4 <= width - 1; x += 4) {
+    Lanes across = sub(load(a + x + 1), load(a + x - 1));
+    Lanes down = sub(load(bBelow + x), load(bAbove + x));
+    store(out + x, mul(half, add(across, mul(signs, down))));
+  }
+#endif
+  for (; x < width - 1; x++) {
+    out[x] = 0.5f * ((a[x + 1] - a[x - 1]) + sign * (bBelow[x] - bAbove[x]));
+  }
+  size_t last = width - 1;
+  out[last] = 0.5f * ((a[last] - a[last - 1]) + sign * (bBelow[last] - bAbove[last]));
+}
+
+// One Jacobi iteration of the pressure Poisson equation, left + right + above + below - 4 p = rhs,
+// with the pressure's edges mirrored so there's no flow through them. A weight below 1 damps it
+// (moving only part way to the Jacobi value), which smooths the checkerboard error better for multigrid.
+void jacobiRow(const float* p, const float* pAbove, const float* pBelow, const float* rhs, float weight, float* out, size_t width) {
+  const float quarterWeight = 0.25f * weight;
+  const float keep = 1.0f - weight;
+  auto cell = [&](size_t x, float left, float right) {
+    out[x] = quarterWeight * (left + right + pAbove[x] + pBelow[x] - rhs[x]) + keep * p[x];
+  };
+  if (width == 1) {
+    cell(0, p[0], p[0]);
+    return;
+  }
+  cell(0, p[0], p[1]);
+  size_t x = 1;
+#if FLUID_SIMD
+  const Lanes quarterWeights = splat(quarterWeight);
+  const Lanes keeps = splat(keep);
+  for (; x + 4 <= width - 1; x += 4) {
+    Lanes sum = add(add(load(p + x - 1), load(p + x + 1)), add(load(pAbove + x), load(pBelow + x)));
+    store(out + x, add(mul(quarterWeights, sub(sum, load(rhs + x))), mul(keeps, load(p + x))));
+  }
+#endif
+  for (; x < width - 1; x++) cell(x, p[x - 1], p[x + 1]);
+  cell(width - 1, p[width - 2], p[width - 1]);
+}
+
+// out = rhs - (left + right + above + below - 4 p), what the pressure is still missing
+void residualRow(const float* p, const float* pAbove, const float* pBelow, const float* rhs, float* out, size_t width) {
+  auto cell = [&](size_t x, float left, float right) {
+    out[x] = rhs[x] - (left + right + pAbove[x] + pBelow[x] - 4.0f * p[x]);
+  };
+  if (width == 1) {
+    cell(0, p[0], p[0]);
+    return;
+  }
+  cell(0, p[0], p[1]);
+  size_t x = 1;
+#if FLUID_SIMD
+  const Lanes four = splat(4.0f);
+  for (; x + 4 <= width - 1; x += 4) {
+    Lanes sum = add(add(load(p + x - 1), load(p + x + 1)), add(load(pAbove + x), load(pBelow + x)));
+    store(out + x, sub(load(rhs + x), sub(sum, mul(four, load(p + x)))));
+  }
+#endif
+  for (; x < width - 1; x++) cell(x, p[x - 1], p[x + 1]);
+  cell(width - 1, p[width - 2], p[width - 1]);
+}
+
+void subtractGradientRow(const float* p, const float* pAbove, const float* pBelow, float* u, float* v, size_t width) {
+  auto cell = [&](size_t x, float left, float right) {
+    u[x] -= 0.5f * (right - left);
+    v[x] -= 0.5f * (pBelow[x] - pAbove[x]);
+  };
+  if (width == 1) {
+    cell(0, p[0], p[0]);
+    return;
+  }
+  cell(0, p[0], p[1]);
+  size_t x = 1;
+#if FLUID_SIMD
+  const Lanes half = splat(0.5f);
+  for (; x + 4 <= width - 1; x += 4) {
+    store(u + x, sub(load(u + x), mul(half, sub(load(p + x + 1), load(p + x - 1)))));
+    store(v + x, sub(load(v + x), mul(half, sub(load(pBelow + x), load(pAbove + x)))));
+  }
+#endif
+  for (; x < width - 1; x++) cell(x, p[x - 1], p[x + 1]);
+  cell(width - 1, p[width - 2], p[width - 1]);
+}
+
+// Vorticity confinement and buoyancy for a row, from the curl around it
+void forcesRow(const float* c, const float* cAbove, const float* cBelow, const float* temperature, const float* alpha,
+               float* u, float* v, size_t width, const CpuFluidSolver::Parameters& parameters) {
+  auto cell = [&](size_t x, float cLeft, float cRight) {
+    float gradientX = 0.5f * (std::abs(cRight) - std::abs(cLeft));
+    float gradientY = 0.5f * (std::abs(cBelow[x]) - std::abs(cAbove[x]));
+    float length = std::sqrt(gradientX * gradientX + gradientY * gradientY) + 1.0e-5f;
+    float forceX = parameters.vorticity * gradientY / length * c[x];
+    float forceY = -parameters.vorticity * gradientX / length * c[x];
+    float lift = parameters.buoyancy * (temperature[x] - parameters.ambientTemperature) - parameters.weight * alpha[x];
+    forceX += lift * parameters.gravityX;
+    forceY += lift * parameters.gravityY;
+    u[x] += parameters.dt * forceX;
+    v[x] += parameters.dt * forceY;
+  };
+  if (width == 1) {
+    cell(0, c[0], c[0]);
+    return;
+  }
+  cell(0, c[0], c[1]);
+  size_t x = 1;
+#if FLUID_SIMD
+  const Lanes half = splat(0.5f);
+  const Lanes epsilon = splat(1.0e-5f);
+  const Lanes vorticity = splat(parameters.vorticity);
+  const Lanes buoyancy = splat(parameters.buoyancy);
+  const Lanes ambient = splat(parameters.ambientTemperature);
+  const Lanes weight = splat(parameters.weight);
+  const Lanes gravityX = splat(parameters.gravityX);
+  const Lanes gravityY = splat(parameters.gravityY);
+  const Lanes dt = splat(parameters.dt);
+  for (; x + 4 <= width - 1; x += 4) {
+    Lanes gradientX = mul(half, sub(absolute(load(c + x + 1)), absolute(load(c + x - 1))));
+    Lanes gradientY = mul(half, sub(absolute(load(cBelow + x)), absolute(load(cAbove + x))));
+    Lanes length = add(squareRoot(add(mul(gradientX, gradientX), mul(gradientY, gradientY))), epsilon);
+    Lanes scale = divide(mul(vorticity, load(c + x)), length);
+    Lanes lift = sub(mul(buoyancy, sub(load(temperature + x), ambient)), mul(weight, load(alpha + x)));
+    Lanes forceX = add(mul(gradientY, scale), mul(lift, gravityX));
+    Lanes forceY = add(sub(splat(0.0f), mul(gradientX, scale)), mul(lift, gravityY));
+    store(u + x, add(load(u + x), mul(dt, forceX)));
+    store(v + x, add(load(v + x), mul(dt, forceY)));
+  }
+#endif
+  for (; x < width - 1; x++) cell(x, c[x - 1], c[x + 1]);
+  cell(width - 1, c[width - 2], c[width - 1]);
+}
+
+// The V-cycle's smoothing either side of the coarse correction, and the damping that suits it on a
+// 5 point Laplacian
+constexpr int SMOOTHING_PAIRS = 1;
+constexpr float SMOOTHING_WEIGHT = 0.8;
+constexpr int COARSEST_PAIRS = 16; // on a few cells across, enough to solve it
+constexpr size_t COARSEST_SIZE = 4;
+
+}
+
+void CpuFluidSolver::setup(size_t width_, size_t height_) {
+  width = std::max<size_t>(1, width_);
+  height = std::max<size_t>(1, height_);
+  size_t cells = width * height;
+  for (Field* field : { &velocityX, &velocityY, &nextVelocityX, &nextVelocityY, &temperature, &nextTemperature,
+                        &pressure, &nextPressure, &divergence, &curl, &residual }) {
+    field->assign(cells, 0.0);
+  }
+  for (size_t channel = 0; channel < VALUE_CHANNELS; channel++) {
+    values[channel].assign(cells, 0.0);
+    nextValues[channel].assign(cells, 0.0);
+  }
+
+  levels.clear();
+  size_t levelWidth = width, levelHeight = height;
+  while (levelWidth > COARSEST_SIZE && levelHeight > COARSEST_SIZE) {
+    levelWidth = (levelWidth + 1) / 2;
+    levelHeight = (levelHeight + 1) / 2;
+    size_t levelCells = levelWidth * levelHeight;
+    levels.push_back({ levelWidth, levelHeight, Field(levelCells), Field(levelCells), Field(levelCells), Field(levelCells) });
+  }
+  pressureResidual = 0.0;
+  pressurePasses = 0;
+}
+
+template <typename F>
+void CpuFluidSolver::forEachBand(size_t rows, F&& f) {
+  size_t bands = (rows + BAND_ROWS - 1) / BAND_ROWS;
+  threadPool.parallel_for(bands, [&](size_t band) {
+    f(band * BAND_ROWS, std::min(rows, (band + 1) * BAND_ROWS));
+  });
+}
+
+void CpuFluidSolver::applyImpulse(const Impulse& impulse) {
+  if (impulse.radius <= 0.0) return;
+  int x0 = std::max(0, static_cast<int>(std::ceil(impulse.x - impulse.radius)));
+  int x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(impulse.x + impulse.radius)));
+  int y0 = std::max(0, static_cast<int>(std::ceil(impulse.y - impulse.radius)));
+  int y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(impulse.y + impulse.radius)));
+  float radiusSquared = impulse.radius * impulse.radius;
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      float dx = x - impulse.x;
+      float dy = y - impulse.y;
+      float distanceSquared = dx * dx + dy * dy;
+      if (distanceSquared >= radiusSquared) continue;
+      // smooth falloff to nothing at the radius
+      float falloff = 1.0f - distanceSquared / radiusSquared;
+      falloff *= falloff;
+      size_t i = y * width + x;
+      for (size_t channel = 0; channel < VALUE_CHANNELS; channel++) {
+        values[channel][i] += impulse.color[channel] * falloff;
+      }
+      temperature[i] += impulse.temperature * falloff;
+      float distance = std::sqrt(distanceSquared);
+      float radialX = distance > 0.0f ? dx / distance : 0.0f;
+      float radialY = distance > 0.0f ? dy / distance : 0.0f;
+      velocityX[i] += (impulse.velocityX + impulse.radialVelocity * radialX) * falloff;
+      velocityY[i] += (impulse.velocityY + impulse.radialVelocity * radialY) * falloff;
+    }
+  }
+}
+
+void CpuFluidSolver::step(const Parameters& parameters) {
+  {
+    PROFILE_STAGE("fluid-advect");
+    advect(parameters);
+  }
+  {
+    PROFILE_STAGE("fluid-forces");
+    addForces(parameters);
+  }
+  {
+    PROFILE_STAGE("fluid-pressure");
+    project(parameters);
+  }
+}
+
+// Everything carried back along the velocity from each cell, sampled bilinearly, in one pass
+void CpuFluidSolver::advect(const Parameters& parameters) {
+  constexpr size_t FIELDS = VALUE_CHANNELS + 3;
+  const float* sources[FIELDS] = { velocityX.data(), velocityY.data(), temperature.data() };
+  float* destinations[FIELDS] = { nextVelocityX.data(), nextVelocityY.data(), nextTemperature.data() };
+  float dissipations[FIELDS] = { parameters.velocityDissipation, parameters.velocityDissipation, parameters.temperatureDissipation };
+  for (size_t channel = 0; channel < VALUE_CHANNELS; channel++) {
+    sources[3 + channel] = values[channel].data();
+    destinations[3 + channel] = nextValues[channel].data();
+    dissipations[3 + channel] = parameters.valueDissipation;
+  }
+
+  forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+    const float maxX = width - 1;
+    const float maxY = height - 1;
+    const int lastColumn = width - 1;
+    const int lastRow = height - 1;
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      const float* u = &velocityX[y * width];
+      const float* v = &velocityY[y * width];
+      for (size_t x = 0; x < width; x++) {
+        float px = std::min(maxX, std::max(0.0f, x - parameters.dt * u[x]));
+        float py = std::min(maxY, std::max(0.0f, y - parameters.dt * v[x]));
+        int x0 = static_cast<int>(px);
+        int y0 = static_cast<int>(py);
+        int x1 = std::min(x0 + 1, lastColumn);
+        int y1 = std::min(y0 + 1, lastRow);
+        float fx = px - x0;
+        float fy = py - y0;
+        size_t i00 = y0 * width + x0, i10 = y0 * width + x1, i01 = y1 * width + x0, i11 = y1 * width + x1;
+        float w00 = (1.0f - fx) * (1.0f - fy), w10 = fx * (1.0f - fy), w01 = (1.0f - fx) * fy, w11 = fx * fy;
+        size_t i = y * width + x;
+        for (size_t field = 0; field < FIELDS; field++) {
+          const float* f = sources[field];
+          destinations[field][i] = (f[i00] * w00 + f[i10] * w10 + f[i01] * w01 + f[i11] * w11) * dissipations[field];
+        }
+      }
+    }
+  });
+  std::swap(velocityX, nextVelocityX);
+  std::swap(velocityY, nextVelocityY);
+  std::swap(values, nextValues);
+  std::swap(temperature, nextTemperature);
+}
+
+// Vorticity confinement puts back the swirl that advection smooths away; buoyancy lifts what's
+// warmer than ambient and weighs down the values (by their alpha), along the gravity force, which
+// points up for lift as in the addon. Up is row 0.
+void CpuFluidSolver::addForces(const Parameters& parameters) {
+  forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      Rows rows { y, height };
+      centralDifferencesRow(&velocityY[y * width], &velocityX[rows.above * width], &velocityX[rows.below * width], -1.0f, &curl[y * width], width);
+    }
+  });
+
+  const float* alpha = values[VALUE_CHANNELS - 1].data();
+  forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      Rows rows { y, height };
+      size_t i = y * width;
+      forcesRow(&curl[i], &curl[rows.above * width], &curl[rows.below * width], &temperature[i], &alpha[i], &velocityX[i], &velocityY[i], width, parameters);
+    }
+  });
+}
+
+// Pressure warm-started from the last step, which is close, so fewer iterations are needed
+void CpuFluidSolver::project(const Parameters& parameters) {
+  forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      Rows rows { y, height };
+      centralDifferencesRow(&velocityX[y * width], &velocityY[rows.above * width], &velocityY[rows.below * width], 1.0f, &divergence[y * width], width);
+    }
+  });
+
+  float divergenceDeviation = deviation(divergence.data(), width, height);
+  auto measureResidual = [&]() {
+    computeResidual(getGrid(0));
+    pressureResidual = divergenceDeviation > 0.0f ? deviation(residual.data(), width, height) / divergenceDeviation : 0.0f;
+  };
+
+  if (parameters.multigrid) {
+    // each V-cycle costs about as much as a handful of Jacobi iterations but takes out the error at
+    // every scale, where Jacobi only smooths away what's a few cells across
+    auto start = std::chrono::steady_clock::now();
+    pressurePasses = 0;
+    while (true) {
+      vCycle(0);
+      pressurePasses++;
+      measureResidual();
+      if (pressureResidual <= parameters.targetResidual || pressurePasses >= parameters.maxCycles) break;
+      std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      if (parameters.budgetMillis > 0.0f && elapsed.count() >= parameters.budgetMillis) break;
+    }
+  } else {
+    for (int iteration = 0; iteration < parameters.pressureIterations; iteration++) {
+      forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+        for (size_t y = rowBegin; y < rowEnd; y++) {
+          Rows rows { y, height };
+          jacobiRow(&pressure[y * width], &pressure[rows.above * width], &pressure[rows.below * width], &divergence[y * width], 1.0f, &nextPressure[y * width], width);
+        }
+      });
+      std::swap(pressure, nextPressure);
+    }
+    pressurePasses = std::max(0, parameters.pressureIterations);
+    measureResidual();
+  }
+
+  forEachBand(height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      Rows rows { y, height };
+      subtractGradientRow(&pressure[y * width], &pressure[rows.above * width], &pressure[rows.below * width], &velocityX[y * width], &velocityY[y * width], width);
+    }
+  });
+}
+
+CpuFluidSolver::Grid CpuFluidSolver::getGrid(size_t level) {
+  if (level == 0) return { width, height, pressure.data(), divergence.data(), residual.data(), nextPressure.data() };
+  Level& l = levels[level - 1];
+  return { l.width, l.height, l.pressure.data(), l.rhs.data(), l.residual.data(), l.scratch.data() };
+}
+
+void CpuFluidSolver::smooth(const Grid& grid, int pairs, float weight) {
+  size_t w = grid.width;
+  auto iterate = [&](const float* p, float* out) {
+    forEachBand(grid.height, [&](size_t rowBegin, size_t rowEnd) {
+      for (size_t y = rowBegin; y < rowEnd; y++) {
+        Rows rows { y, grid.height };
+        jacobiRow(&p[y * w], &p[rows.above * w], &p[rows.below * w], &grid.rhs[y * w], weight, &out[y * w], w);
+      }
+    });
+  };
+  for (int pair = 0; pair < pairs; pair++) {
+    iterate(grid.pressure, grid.scratch);
+    iterate(grid.scratch, grid.pressure);
+  }
+}
+
+void CpuFluidSolver::computeResidual(const Grid& grid) {
+  size_t w = grid.width;
+  const float* p = grid.pressure;
+  forEachBand(grid.height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      Rows rows { y, grid.height };
+      residualRow(&p[y * w], &p[rows.above * w], &p[rows.below * w], &grid.rhs[y * w], &grid.residual[y * w], w);
+    }
+  });
+}
+
+// RMS about the mean, summed in bands and then in band order so it's the same for any thread count
+float CpuFluidSolver::deviation(const float* field, size_t fieldWidth, size_t fieldHeight) {
+  size_t bands = (fieldHeight + BAND_ROWS - 1) / BAND_ROWS;
+  bandSums.assign(bands * 2, 0.0);
+  forEachBand(fieldHeight, [&](size_t rowBegin, size_t rowEnd) {
+    double sum = 0.0, sumSquares = 0.0;
+    for (size_t i = rowBegin * fieldWidth; i < rowEnd * fieldWidth; i++) {
+      sum += field[i];
+      sumSquares += double(field[i]) * field[i];
+    }
+    size_t band = rowBegin / BAND_ROWS;
+    bandSums[band * 2] = sum;
+    bandSums[band * 2 + 1] = sumSquares;
+  });
+  double sum = 0.0, sumSquares = 0.0;
+  for (size_t band = 0; band < bands; band++) {
+    sum += bandSums[band * 2];
+    sumSquares += bandSums[band * 2 + 1];
+  }
+  double cells = fieldWidth * fieldHeight;
+  double mean = sum / cells;
+  return std::sqrt(std::max(0.0, sumSquares / cells - mean * mean));
+}
+
+// Smooth, solve for the error on the next level down from the residual, add it back bilinearly, and
+// smooth again. The coarse levels start from no correction each time.
+void CpuFluidSolver::vCycle(size_t level) {
+  Grid grid = getGrid(level);
+  if (level > 0) {
+    // the closed edges mean only a right-hand side that sums to nothing has a solution
+    size_t cells = grid.width * grid.height;
+    float mean = std::accumulate(grid.rhs, grid.rhs + cells, 0.0) / cells;
+    for (size_t i = 0; i < cells; i++) grid.rhs[i] -= mean;
+  }
+  if (level == levels.size()) {
+    smooth(grid, COARSEST_PAIRS, SMOOTHING_WEIGHT);
+    return;
+  }
+
+  smooth(grid, SMOOTHING_PAIRS, SMOOTHING_WEIGHT);
+  computeResidual(grid);
+
+  // each coarse cell gets the residual of the four it covers, summed as its cells are twice as far
+  // apart; past an odd edge there are only two, or one
+  Grid coarse = getGrid(level + 1);
+  forEachBand(coarse.height, [&](size_t rowBegin, size_t rowEnd) {
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      const float* r = &grid.residual[2 * y * grid.width];
+      const float* below = 2 * y + 1 < grid.height ? r + grid.width : nullptr;
+      for (size_t x = 0; x < coarse.width; x++) {
+        size_t left = 2 * x, right = 2 * x + 1;
+        float sum = r[left] + (below ? below[left] : 0.0f);
+        if (right < grid.width) sum += r[right] + (below ? below[right] : 0.0f);
+        coarse.rhs[y * coarse.width + x] = sum;
+      }
+    }
+  });
+  std::fill(coarse.pressure, coarse.pressure + coarse.width * coarse.height, 0.0f);
+  vCycle(level + 1);
+
+  // each fine cell is a quarter of the way from its coarse cell's centre to the next one out
+  forEachBand(grid.height, [&](size_t rowBegin, size_t rowEnd) {
+    const size_t lastColumn = coarse.width - 1;
+    const size_t lastRow = coarse.height - 1;
+    for (size_t y = rowBegin; y < rowEnd; y++) {
+      size_t coarseY = y / 2;
+      size_t nextY = y % 2 ? std::min(coarseY + 1, lastRow) : (coarseY > 0 ? coarseY - 1 : 0);
+      const float* near = &coarse.pressure[coarseY * coarse.width];
+      const float* far = &coarse.pressure[nextY * coarse.width];
+      float* p = &grid.pressure[y * grid.width];
+      for (size_t x = 0; x < grid.width; x++) {
+        size_t coarseX = x / 2;
+        size_t nextX = x % 2 ? std::min(coarseX + 1, lastColumn) : (coarseX > 0 ? coarseX - 1 : 0);
+        p[x] += 0.5625f * near[coarseX] + 0.1875f * (near[nextX] + far[coarseX]) + 0.0625f * far[nextX];
+      }
+    }
+  });
+
+  smooth(grid, SMOOTHING_PAIRS, SMOOTHING_WEIGHT);
+}
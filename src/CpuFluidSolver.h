@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "dkm_parallel.hpp"
+
+// Stable fluids on the CPU, the same steps as the FluidSimulation shaders: semi-Lagrangian advection
+// of velocity, values and temperature with dissipation, buoyancy, vorticity confinement, then a
+// pressure solve to make the velocity divergence free, either a fixed number of Jacobi iterations
+// or multigrid V-cycles until the residual is small enough. Everything is on one collocated grid
+// in cells, clamped at the edges, with each field a plane of floats so rows can be streamed four
+// cells at a time (SSE2 or NEON), and every pass shared between threads in bands of rows.
+//
+// There's nothing here that needs a window or a GPU, so the fluid can be run and benchmarked
+// headless; CpuFluidSimulation puts it behind FluidSimulation's interface for the app.
+class CpuFluidSolver {
+
+public:
+  struct Parameters {
+    float dt { 0.02 };
+    float vorticity { 15.0 };
+    float valueDissipation { 0.9975 };
+    float velocityDissipation { 0.9999 };
+    float temperatureDissipation { 0.99 };
+    float buoyancy { 1.0 }; // lift per degree above ambient
+    float weight { 0.05 }; // lift lost per unit of value alpha
+    float ambientTemperature { 0.0 };
+    float gravityX { 0.0 }, gravityY { -0.98 }; // scales lift into an acceleration, as the addon's gravityForce; -y is up
+
+    int pressureIterations { 22 };
+    bool multigrid { false }; // V-cycles instead of the Jacobi iterations
+    float targetResidual { 0.01 }; // V-cycles stop once the residual is this fraction of the divergence
+    int maxCycles { 4 };
+    float budgetMillis { 0.0 }; // or once the solve has taken this long, 0 for no limit; there's always one
+  };
+
+  // In cells, with cell centres at whole coordinates
+  struct Impulse {
+    float x, y;
+    float radius;
+    float velocityX, velocityY; // cells per unit time
+    float radialVelocity; // outwards, cells per unit time
+    std::array<float, 4> color; // added to the values
+    float temperature;
+  };
+
+  static constexpr size_t VALUE_CHANNELS = 4;
+
+  void setup(size_t width, size_t height); // everything starts at rest and empty
+  void setThreadCount(size_t count) { threadPool.set_thread_count(count); }
+
+  void applyImpulse(const Impulse& impulse);
+  void step(const Parameters& parameters);
+
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+  float* getValues(size_t channel) { return values[channel].data(); }
+  const float* getValues(size_t channel) const { return values[channel].data(); }
+  const float* getVelocityX() const { return velocityX.data(); }
+  const float* getVelocityY() const { return velocityY.data(); }
+  const float* getPressure() const { return pressure.data(); }
+
+  // How far the last pressure solve was from exact, as the RMS of its Poisson residual over the RMS
+  // of the divergence (both less their means, which can't be solved away with closed edges), and the
+  // Jacobi iterations or V-cycles it took
+  float getPressureResidual() const { return pressureResidual; }
+  int getPressurePasses() const { return pressurePasses; }
+
+private:
+  static constexpr size_t BAND_ROWS = 16; // rows per task handed to the thread pool
+
+  using Field = std::vector<float>;
+
+  size_t width { 0 }, height { 0 };
+  dkm::thread_pool threadPool { 1 };
+
+  Field velocityX, velocityY, nextVelocityX, nextVelocityY;
+  std::array<Field, VALUE_CHANNELS> values, nextValues;
+  Field temperature, nextTemperature;
+  Field pressure, nextPressure;
+  Field divergence, curl;
+  Field residual;
+  float pressureResidual { 0.0 };
+  int pressurePasses { 0 };
+
+  // The multigrid levels below the fine grid, each half the size of the one above, down to a few
+  // cells across where the error can be smoothed away directly
+  struct Level {
+    size_t width, height;
+    Field pressure, rhs, residual, scratch;
+  };
+  std::vector<Level> levels;
+  std::vector<double> bandSums;
+
+  // The fine grid's pressure fields or a level's, for the passes that run on any of them
+  struct Grid {
+    size_t width, height;
+    float* pressure;
+    float* rhs;
+    float* residual;
+    float* scratch;
+  };
+  Grid getGrid(size_t level); // 0 is the fine grid
+
+  template <typename F>
+  void forEachBand(size_t rows, F&& f);
+
+  void advect(const Parameters& parameters);
+  void addForces(const Parameters& parameters);
+  void project(const Parameters& parameters);
+  void smooth(const Grid& grid, int pairs, float weight); // Jacobi iterations in pairs, so they end in the pressure
+  void computeResidual(const Grid& grid);
+  float deviation(const float* field, size_t fieldWidth, size_t fieldHeight);
+  void vCycle(size_t level);
+};
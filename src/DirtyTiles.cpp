@@ -0,0 +1,91 @@
+#include "DirtyTiles.h"
+#include <algorithm>
+#include <cmath>
+
+uint32_t DirtyTiles::settleFramesFor(float fadeAlpha, LayerFormat format) {
+  if (fadeAlpha >= 1.0) return 1;
+  if (fadeAlpha <= 0.0) return 0; // fading changes nothing
+  // (1 - a)^n < precision / 2 for the distance to the fixed point; rounding only stalls sooner
+  return static_cast<uint32_t>(std::ceil(std::log(0.5 * layerFormatPrecision(format)) / std::log(1.0 - fadeAlpha))) + 1;
+}
+
+void DirtyTiles::setup(size_t width_, size_t height_, size_t tileSize_) {
+  width = width_;
+  height = height_;
+  tileSize = std::max<size_t>(1, tileSize_);
+  tilesAcross = (width + tileSize - 1) / tileSize;
+  tilesDown = (height + tileSize - 1) / tileSize;
+  countdowns.assign(tilesAcross * tilesDown, 0);
+  markAll();
+}
+
+void DirtyTiles::setFade(float alpha, LayerFormat format) {
+  if (alpha == fadeAlpha && format == fadeFormat) return;
+  fadeAlpha = alpha;
+  fadeFormat = format;
+  settleFrames = settleFramesFor(alpha, format);
+  markAll();
+}
+
+void DirtyTiles::markAll() {
+  std::fill(countdowns.begin(), countdowns.end(), settleFrames);
+}
+
+void DirtyTiles::mark(float x0, float y0, float x1, float y1) {
+  if (countdowns.empty()) return;
+  float px0 = std::min(x0, x1) * width - MARGIN_PIXELS;
+  float px1 = std::max(x0, x1) * width + MARGIN_PIXELS;
+  float py0 = std::min(y0, y1) * height - MARGIN_PIXELS;
+  float py1 = std::max(y0, y1) * height + MARGIN_PIXELS;
+  if (px1 < 0.0 || py1 < 0.0 || px0 >= width || py0 >= height) return;
+  size_t column0 = std::max(0.0f, px0) / tileSize;
+  size_t column1 = std::min<size_t>(tilesAcross - 1, std::min<float>(px1, width - 1) / tileSize);
+  size_t row0 = std::max(0.0f, py0) / tileSize;
+  size_t row1 = std::min<size_t>(tilesDown - 1, std::min<float>(py1, height - 1) / tileSize);
+  for (size_t row = row0; row <= row1; row++) {
+    std::fill(countdowns.begin() + row * tilesAcross + column0, countdowns.begin() + row * tilesAcross + column1 + 1, settleFrames);
+  }
+}
+
+void DirtyTiles::closeRun(const Run& run, size_t endRow) {
+  float x = run.begin * tileSize;
+  float y = run.row * tileSize;
+  rects.push_back({ x, y, std::min<float>(run.end * tileSize, width) - x, std::min<float>(endRow * tileSize, height) - y });
+}
+
+const std::vector<DirtyTiles::Rect>& DirtyTiles::regions() {
+  rects.clear();
+  openRuns.clear();
+  activeTileCount = 0;
+
+  for (size_t row = 0; row < tilesDown; row++) {
+    // runs of unsettled tiles in this row, each counted down a frame
+    rowRuns.clear();
+    uint32_t* rowCountdowns = &countdowns[row * tilesAcross];
+    for (size_t column = 0; column < tilesAcross; column++) {
+      if (rowCountdowns[column] == 0) continue;
+      rowCountdowns[column]--;
+      activeTileCount++;
+      if (!rowRuns.empty() && rowRuns.back().end == column) {
+        rowRuns.back().end++;
+      } else {
+        rowRuns.push_back({ column, column + 1, row });
+      }
+    }
+
+    // a run carries on down from the row above if it spans the same columns; both are in column order
+    auto open = openRuns.begin();
+    for (auto& run : rowRuns) {
+      while (open != openRuns.end() && open->begin < run.begin) closeRun(*open++, row);
+      if (open != openRuns.end() && open->begin == run.begin) {
+        if (open->end == run.end) run.row = open->row;
+        else closeRun(*open, row);
+        open++;
+      }
+    }
+    while (open != openRuns.end()) closeRun(*open++, row);
+    std::swap(openRuns, rowRuns);
+  }
+  for (const auto& run : openRuns) closeRun(run, tilesDown);
+  return rects;
+}
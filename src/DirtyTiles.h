@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "LayerFormat.h"
+
+// Which tiles of a faded layer still change when faded. Fading blends towards a fixed point, so
+// once a tile has been faded for settleFrames since it was last drawn into, fading it again
+// changes nothing and it can be skipped until it's next marked. Everything starts unsettled,
+// since even a cleared tile moves towards the fade's alpha.
+//
+// mark() takes normalised bounds of what was drawn; regions() gives the tiles to fade this frame as
+// rectangles in pixels, runs of tiles in a row merged with identical runs in the rows below.
+class DirtyTiles {
+
+public:
+  struct Rect {
+    float x, y, width, height;
+  };
+
+  // Enough fades with alpha for any value in the format to come within half its precision of the
+  // fixed point, where a fixed point format's rounding stops it changing
+  static uint32_t settleFramesFor(float fadeAlpha, LayerFormat format);
+
+  void setup(size_t width, size_t height, size_t tileSize);
+  // Settles everything again whenever either changes, since what a tile settles to depends on both
+  void setFade(float alpha, LayerFormat format);
+  void markAll();
+  void mark(float x0, float y0, float x1, float y1);
+
+  // Counts each returned tile down a frame
+  const std::vector<Rect>& regions();
+
+  size_t getTileCount() const { return countdowns.size(); }
+  size_t getActiveTileCount() const { return activeTileCount; } // as of the last regions()
+
+private:
+  // covers antialiasing and outline strokes past the geometric bounds
+  static constexpr float MARGIN_PIXELS = 2.0;
+
+  size_t width { 0 }, height { 0 };
+  size_t tileSize { 1 };
+  size_t tilesAcross { 0 }, tilesDown { 0 };
+  float fadeAlpha { 1.0 };
+  LayerFormat fadeFormat { LayerFormat::RGBA8 };
+  uint32_t settleFrames { 1 }; // settleFramesFor(fadeAlpha, fadeFormat)
+  std::vector<uint32_t> countdowns; // fades still needed per tile
+  size_t activeTileCount { 0 };
+
+  struct Run {
+    size_t begin, end; // tile columns
+    size_t row; // where the run started
+  };
+  std::vector<Run> openRuns, rowRuns;
+  std::vector<Rect> rects;
+
+  void closeRun(const Run& run, size_t endRow);
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <variant>
+#include <vector>
+#include "ofColor.h"
+#include "ofGraphicsConstants.h"
+#include "glm/vec2.hpp"
+
+// What BellsEngine asks to be drawn each frame, in the order it should be drawn. Positions and
+// sizes are normalised: positions to [0, 1] across the target layer and sizes as a fraction of the
+// layer width, so the engine doesn't need to know how big anything is or that there is a GPU.
+namespace DrawCommands {
+
+enum class Layer { Foreground, Divisions, Fluid };
+
+struct LineSegment {
+  glm::vec2 start;
+  glm::vec2 end;
+};
+
+struct Circle {
+  Layer layer;
+  ofBlendMode blendMode;
+  ofFloatColor color;
+  glm::vec2 centre;
+  float radius;
+  bool filled;
+};
+
+struct Arc {
+  Layer layer;
+  ofBlendMode blendMode;
+  ofFloatColor color;
+  glm::vec2 centre;
+  float radius;
+  float angleBegin; // degrees
+  float angleEnd;
+};
+
+// Closed polygon through the points
+struct Polygon {
+  Layer layer;
+  ofBlendMode blendMode;
+  ofFloatColor color;
+  std::vector<glm::vec2> points;
+};
+
+// Each segment drawn as a rectangle of the given width
+struct Lines {
+  Layer layer;
+  ofBlendMode blendMode;
+  ofFloatColor color;
+  float width;
+  bool filled;
+  std::vector<LineSegment> segments;
+};
+
+// The DividedArea's unconstrained lines, drawn as DividedArea::draw did: rectangles of lineWidth,
+// filled or outlined as the commands before left it
+struct Divisions {
+  Layer layer;
+  ofBlendMode blendMode;
+  ofFloatColor color;
+  float lineWidth;
+  bool uniformScale; // scale by the layer width in both directions
+  std::vector<LineSegment> segments;
+};
+
+// Fill the polygon with a view of the frozen fluid centred on centre and magnified by scale
+struct Crystal {
+  std::vector<glm::vec2> points;
+  glm::vec2 centre;
+  float scale;
+};
+
+// Keep a copy of the fluid layer as it is now for later Crystals
+struct FreezeFluid {};
+
+struct FluidImpulse {
+  glm::vec2 position;
+  float radius;
+  float radialVelocity;
+  ofFloatColor color;
+  float temperature;
+};
+
+struct PlotLine {
+  glm::vec2 start;
+  glm::vec2 end;
+  ofColor color;
+  int lifetime;
+};
+
+struct PlotArc {
+  glm::vec2 centre;
+  float radius;
+  float angleBegin;
+  float angleEnd;
+  ofColor color;
+  int lifetime;
+};
+
+struct IntrospectorCircle {
+  glm::vec2 centre;
+  float radius; // fraction of the window width
+  ofColor color;
+  bool filled;
+  int lifetime;
+};
+
+}
+
+using DrawCommand = std::variant<DrawCommands::Circle, DrawCommands::Arc, DrawCommands::Polygon, DrawCommands::Lines,
+                                 DrawCommands::Divisions, DrawCommands::Crystal, DrawCommands::FreezeFluid,
+                                 DrawCommands::FluidImpulse, DrawCommands::PlotLine, DrawCommands::PlotArc,
+                                 DrawCommands::IntrospectorCircle>;
@@ -0,0 +1,91 @@
+#include "FluidBenchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include "CpuFluidSolver.h"
+#include "Constants.h"
+#include "Xoshiro256.h"
+
+namespace {
+
+constexpr int WARMUP_STEPS = 3;
+constexpr int TIMED_STEPS = 10;
+
+// A dozen impulses a step at wandering positions, as many as there are cluster means
+void addImpulses(CpuFluidSolver& solver, Xoshiro256& random) {
+  float width = solver.getWidth();
+  float height = solver.getHeight();
+  for (int i = 0; i < 12; i++) {
+    float x = random.uniform() * width;
+    float y = random.uniform() * height;
+    float radius = 0.085 * width;
+    float gray = 0.008 * random.uniform();
+    solver.applyImpulse({ x, y, radius, 0.0, 0.0, 0.0003f * width, { gray, gray, gray, 0.005f * random.uniform() }, 1.0 });
+  }
+}
+
+struct Timing {
+  double millisecondsPerStep;
+  double pressureResidual; // averaged over the timed steps
+};
+
+Timing timeSteps(size_t width, size_t height, const CpuFluidSolver::Parameters& parameters, size_t threads) {
+  CpuFluidSolver solver;
+  solver.setup(width, height);
+  solver.setThreadCount(threads);
+  Xoshiro256 random { 1 };
+
+  for (int i = 0; i < WARMUP_STEPS; i++) {
+    addImpulses(solver, random);
+    solver.step(parameters);
+  }
+  double residual = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < TIMED_STEPS; i++) {
+    addImpulses(solver, random);
+    solver.step(parameters);
+    residual += solver.getPressureResidual();
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return { elapsed.count() / TIMED_STEPS, residual / TIMED_STEPS };
+}
+
+}
+
+void benchmarkFluid(std::ostream& out) {
+  std::vector<size_t> threadCounts { 1 };
+  size_t maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads > 1) threadCounts.push_back(maxThreads);
+  // Jacobi iterations against a fixed number of V-cycles, with the residual each leaves
+  std::vector<CpuFluidSolver::Parameters> pressureSolves;
+  for (int iterations : { 10, 22, 40 }) {
+    CpuFluidSolver::Parameters parameters;
+    parameters.pressureIterations = iterations;
+    pressureSolves.push_back(parameters);
+  }
+  for (int cycles : { 1, 2, 4 }) {
+    CpuFluidSolver::Parameters parameters;
+    parameters.multigrid = true;
+    parameters.targetResidual = 0.0;
+    parameters.maxCycles = cycles;
+    pressureSolves.push_back(parameters);
+  }
+
+  out << "scale,width,height,pressure,passes,threads,msPerStep,nsPerCell,residual" << std::endl;
+  for (float scale : { 0.125f, 0.25f, 0.5f }) {
+    size_t width = Constants::FLUID_WIDTH * scale;
+    size_t height = Constants::FLUID_HEIGHT * scale;
+    for (const auto& parameters : pressureSolves) {
+      for (size_t threads : threadCounts) {
+        Timing timing = timeSteps(width, height, parameters, threads);
+        out << scale << "," << width << "," << height << "," << (parameters.multigrid ? "multigrid" : "jacobi") << ","
+            << (parameters.multigrid ? parameters.maxCycles : parameters.pressureIterations) << "," << threads << ","
+            << std::fixed << std::setprecision(2) << timing.millisecondsPerStep << "," << timing.millisecondsPerStep * 1.0e6 / (width * height) << ","
+            << std::setprecision(4) << timing.pressureResidual << std::endl;
+        out.copyfmt(std::ios(nullptr)); // back to the default float format for the scale
+      }
+    }
+  }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <ostream>
+
+// Times CpuFluidSolver steps headless over a range of grid sizes (fractions of the fluid size),
+// pressure solves (Jacobi iterations or multigrid V-cycles) and thread counts, with impulses like
+// the app's keeping the fluid moving, and writes a table of milliseconds per step and the pressure
+// residual left. Run with bells2 --benchmark-fluid.
+void benchmarkFluid(std::ostream& out);
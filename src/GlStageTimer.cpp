@@ -0,0 +1,72 @@
+#include "GlStageTimer.h"
+
+namespace {
+
+// More than this many unresolved stages means results aren't being collected, so stop issuing queries
+constexpr size_t MAX_PENDING_QUERIES = 4096;
+
+}
+
+GlStageTimer::~GlStageTimer() {
+  if (!available) return;
+  for (const auto& query : pendingQueries) freeQueries.insert(freeQueries.end(), { query.begin, query.end });
+  for (const auto& query : openQueries) freeQueries.push_back(query.begin);
+  if (!freeQueries.empty()) glDeleteQueries(freeQueries.size(), freeQueries.data());
+}
+
+void GlStageTimer::setup() {
+#ifdef TARGET_OPENGLES
+  available = false;
+#else
+  available = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+  if (!available) ofLogNotice() << "profile: no GL timer queries, profiling CPU time only";
+}
+
+GLuint GlStageTimer::takeQuery() {
+  if (freeQueries.empty()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+  GLuint query = freeQueries.back();
+  freeQueries.pop_back();
+  return query;
+}
+
+void GlStageTimer::begin(size_t stage, uint64_t frame) {
+  if (pendingQueries.size() >= MAX_PENDING_QUERIES) return;
+  GLuint query = takeQuery();
+#ifndef TARGET_OPENGLES
+  glQueryCounter(query, GL_TIMESTAMP);
+#endif
+  openQueries.push_back({ stage, frame, query, 0 });
+}
+
+void GlStageTimer::end(size_t stage) {
+  if (openQueries.empty() || openQueries.back().stage != stage) return; // begin was skipped
+  Query query = openQueries.back();
+  openQueries.pop_back();
+  query.end = takeQuery();
+#ifndef TARGET_OPENGLES
+  glQueryCounter(query.end, GL_TIMESTAMP);
+#endif
+  pendingQueries.push_back(query);
+}
+
+void GlStageTimer::collect(StageProfiler& profiler) {
+#ifndef TARGET_OPENGLES
+  while (!pendingQueries.empty()) {
+    const Query& query = pendingQueries.front();
+    GLint resultAvailable = 0;
+    glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &resultAvailable);
+    if (!resultAvailable) break;
+    GLuint64 beginNanos, endNanos;
+    glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT, &beginNanos);
+    glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &endNanos);
+    profiler.addGpuSample(query.stage, query.frame, endNanos - beginNanos);
+    freeQueries.insert(freeQueries.end(), { query.begin, query.end });
+    pendingQueries.pop_front();
+  }
+#endif
+}
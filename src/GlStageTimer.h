@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ofMain.h"
+#include "StageProfiler.h"
+#include <deque>
+
+// GPU time of profiled stages from GL_TIMESTAMP queries (ARB_timer_query, core in GL 3.3). Timestamps
+// rather than GL_TIME_ELAPSED so stages can nest. Query results are read back only once the GPU
+// has them, so profiling never stalls the pipeline. Unavailable on contexts without timer queries,
+// e.g. the legacy 2.1 context on macOS, in which case only CPU time is profiled.
+class GlStageTimer : public GpuStageTimer {
+
+public:
+  GlStageTimer() = default;
+  ~GlStageTimer();
+  GlStageTimer(const GlStageTimer&) = delete;
+  GlStageTimer& operator=(const GlStageTimer&) = delete;
+
+  void setup(); // needs the GL context
+  bool isAvailable() const override { return available; }
+  void begin(size_t stage, uint64_t frame) override;
+  void end(size_t stage) override;
+  void collect(StageProfiler& profiler) override;
+
+private:
+  struct Query {
+    size_t stage;
+    uint64_t frame;
+    GLuint begin;
+    GLuint end;
+  };
+
+  bool available { false };
+  std::vector<GLuint> freeQueries;
+  std::vector<Query> openQueries; // begun but not ended, innermost last
+  std::deque<Query> pendingQueries; // ended, in the order the GPU will finish them
+
+  GLuint takeQuery();
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+// Pixel formats a canvas layer can be allocated with, numbered as in the layer format parameters.
+// RGB10_A2 has only four levels of alpha, so fades and alpha blending into it are coarse.
+enum class LayerFormat { RGBA8, RGBA16F, RGBA32F, RGB10_A2, R8 };
+
+static constexpr int LAYER_FORMAT_COUNT = 5;
+
+inline size_t layerFormatBytesPerPixel(LayerFormat format) {
+  switch (format) {
+    case LayerFormat::RGBA16F: return 8;
+    case LayerFormat::RGBA32F: return 16;
+    case LayerFormat::R8: return 1;
+    case LayerFormat::RGBA8: case LayerFormat::RGB10_A2: default: return 4;
+  }
+}
+
+// The smallest step between colour values near full scale: a quantisation step for the fixed
+// point formats, the mantissa's last place at 1.0 for the float ones
+inline double layerFormatPrecision(LayerFormat format) {
+  switch (format) {
+    case LayerFormat::RGBA16F: return 1.0 / 1024.0;
+    case LayerFormat::RGBA32F: return 1.0 / 8388608.0;
+    case LayerFormat::RGB10_A2: return 1.0 / 1023.0;
+    case LayerFormat::RGBA8: case LayerFormat::R8: default: return 1.0 / 255.0;
+  }
+}
+
+inline const char* layerFormatName(LayerFormat format) {
+  switch (format) {
+    case LayerFormat::RGBA16F: return "RGBA16F";
+    case LayerFormat::RGBA32F: return "RGBA32F";
+    case LayerFormat::RGB10_A2: return "RGB10_A2";
+    case LayerFormat::R8: return "R8";
+    case LayerFormat::RGBA8: default: return "RGBA8";
+  }
+}
@@ -0,0 +1,39 @@
+#include "LineBatch.h"
+#include <algorithm>
+#include <cmath>
+
+void LineBatch::clear(bool filled_) {
+  filled = filled_;
+  vertices.clear();
+  indices.clear();
+  segmentBounds.clear();
+}
+
+void LineBatch::add(glm::vec2 start, glm::vec2 end, float width, glm::vec2 scale) {
+  float dx = end.x - start.x;
+  float dy = end.y - start.y;
+  float length = std::sqrt(dx * dx + dy * dy);
+  if (length == 0.0) return; // a zero length rectangle, which drew nothing
+
+  // half the width along the segment's normal
+  float nx = -dy / length * width / 2.0;
+  float ny = dx / length * width / 2.0;
+  uint32_t first = vertices.size();
+  vertices.push_back({ (start.x - nx) * scale.x, (start.y - ny) * scale.y, 0.0 });
+  vertices.push_back({ (end.x - nx) * scale.x, (end.y - ny) * scale.y, 0.0 });
+  vertices.push_back({ (end.x + nx) * scale.x, (end.y + ny) * scale.y, 0.0 });
+  vertices.push_back({ (start.x + nx) * scale.x, (start.y + ny) * scale.y, 0.0 });
+
+  Bounds bounds { { vertices[first].x, vertices[first].y }, { vertices[first].x, vertices[first].y } };
+  for (uint32_t corner = first + 1; corner < first + 4; corner++) {
+    bounds.min = { std::min(bounds.min.x, vertices[corner].x), std::min(bounds.min.y, vertices[corner].y) };
+    bounds.max = { std::max(bounds.max.x, vertices[corner].x), std::max(bounds.max.y, vertices[corner].y) };
+  }
+  segmentBounds.push_back(bounds);
+
+  if (filled) {
+    indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+  } else {
+    indices.insert(indices.end(), { first, first + 1, first + 1, first + 2, first + 2, first + 3, first + 3, first });
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+
+// Line segments drawn as rectangles of a given width, expanded on the CPU into one vertex and index
+// buffer so a whole set of lines goes to the GPU in a single draw rather than a matrix push, rotate
+// and rectangle per segment. The rectangles match what ofDrawRectangle gave in the rotated frame:
+// the segment's length along it and width/2 either side.
+//
+// Filled batches index two triangles per rectangle; outlined ones, as ofNoFill drew them, four lines.
+class LineBatch {
+
+public:
+  struct Bounds {
+    glm::vec2 min, max; // scaled
+  };
+
+  void clear(bool filled);
+  // Expanded in the segments' own (normalised) space, then scaled, as ofScale before the segments did
+  void add(glm::vec2 start, glm::vec2 end, float width, glm::vec2 scale);
+
+  bool isEmpty() const { return indices.empty(); }
+  bool isFilled() const { return filled; }
+  const std::vector<glm::vec3>& getVertices() const { return vertices; }
+  const std::vector<uint32_t>& getIndices() const { return indices; }
+  const std::vector<Bounds>& getSegmentBounds() const { return segmentBounds; } // one per rectangle, in order
+
+private:
+  bool filled { true };
+  std::vector<glm::vec3> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<Bounds> segmentBounds;
+};
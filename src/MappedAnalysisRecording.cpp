@@ -0,0 +1,157 @@
+#include "MappedAnalysisRecording.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = { 'B', 'E', 'L', 'L', 'S', 'A', 'R', '1' };
+constexpr uint32_t VERSION = 1;
+// Index entries are no closer together than this, to keep the index small for dense recordings
+constexpr double MIN_INDEX_INTERVAL = 0.001;
+
+uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~uint64_t(7);
+}
+
+// Whether an aligned column of count elements of elementSize starting at offset ends by end,
+// without overflowing for whatever a damaged header holds
+bool columnFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t end) {
+  if (offset % 8 != 0 || offset > end) return false;
+  return count <= (end - offset) / elementSize;
+}
+
+}
+
+bool MappedAnalysisRecording::write(const AnalysisRecording& recording, const std::string& path) {
+  const uint64_t frameCount = recording.size();
+  const uint32_t scalarCount = recording.getScalarCount();
+  if (frameCount == 0) return false;
+
+  Header fileHeader {};
+  std::memcpy(fileHeader.magic, MAGIC, sizeof(MAGIC));
+  fileHeader.version = VERSION;
+  fileHeader.scalarCount = scalarCount;
+  fileHeader.frameCount = frameCount;
+  // about one frame per index entry on average
+  fileHeader.indexInterval = std::max(MIN_INDEX_INTERVAL, recording.getDuration() / frameCount);
+  fileHeader.indexCount = static_cast<uint64_t>(recording.getDuration() / fileHeader.indexInterval) + 1;
+  fileHeader.timesOffset = align8(sizeof(Header));
+  fileHeader.valuesOffset = align8(fileHeader.timesOffset + frameCount * sizeof(double));
+  fileHeader.indexOffset = align8(fileHeader.valuesOffset + uint64_t(scalarCount) * frameCount * sizeof(float));
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  auto pad = [&file](uint64_t offset) {
+    static const char zeros[8] = {};
+    file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+  };
+
+  file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(Header));
+
+  pad(fileHeader.timesOffset);
+  std::vector<double> timeColumn(frameCount);
+  for (size_t frame = 0; frame < frameCount; frame++) timeColumn[frame] = recording.getTime(frame);
+  file.write(reinterpret_cast<const char*>(timeColumn.data()), frameCount * sizeof(double));
+
+  pad(fileHeader.valuesOffset);
+  std::vector<float> column(frameCount);
+  for (size_t scalar = 0; scalar < scalarCount; scalar++) {
+    for (size_t frame = 0; frame < frameCount; frame++) column[frame] = recording.getScalar(frame, scalar);
+    file.write(reinterpret_cast<const char*>(column.data()), frameCount * sizeof(float));
+  }
+
+  pad(fileHeader.indexOffset);
+  std::vector<uint64_t> indexColumn(fileHeader.indexCount);
+  uint64_t frame = 0;
+  for (uint64_t i = 0; i < fileHeader.indexCount; i++) {
+    double time = i * fileHeader.indexInterval;
+    while (frame + 1 < frameCount && timeColumn[frame + 1] <= time) frame++;
+    indexColumn[i] = frame;
+  }
+  file.write(reinterpret_cast<const char*>(indexColumn.data()), fileHeader.indexCount * sizeof(uint64_t));
+
+  return static_cast<bool>(file);
+}
+
+MappedAnalysisRecording::~MappedAnalysisRecording() {
+  unmap();
+}
+
+void MappedAnalysisRecording::unmap() {
+  if (mapping) munmap(mapping, mappingSize);
+  mapping = nullptr;
+  mappingSize = 0;
+  header = nullptr;
+  times = nullptr;
+  values = nullptr;
+  index = nullptr;
+}
+
+bool MappedAnalysisRecording::load(const std::string& path) {
+  unmap();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  size_t fileSize = fileStat.st_size;
+  void* fileMapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if (fileMapping == MAP_FAILED) return false;
+  mapping = fileMapping;
+  mappingSize = fileSize;
+
+  const Header* fileHeader = static_cast<const Header*>(mapping);
+  bool valid = std::memcmp(fileHeader->magic, MAGIC, sizeof(MAGIC)) == 0
+    && fileHeader->version == VERSION
+    && fileHeader->frameCount > 0
+    && fileHeader->indexCount > 0
+    && fileHeader->indexInterval > 0.0
+    && fileHeader->frameCount <= UINT64_MAX / sizeof(float) / std::max<uint64_t>(1, fileHeader->scalarCount)
+    && columnFits(fileHeader->timesOffset, fileHeader->frameCount, sizeof(double), fileHeader->valuesOffset)
+    && columnFits(fileHeader->valuesOffset, uint64_t(fileHeader->scalarCount) * fileHeader->frameCount, sizeof(float), fileHeader->indexOffset)
+    && columnFits(fileHeader->indexOffset, fileHeader->indexCount, sizeof(uint64_t), fileSize);
+  if (valid) {
+    // Checked once here so frameAt can trust the columns: times ascend, and the index only points at frames
+    const char* fileBytes = static_cast<const char*>(mapping);
+    const double* fileTimes = reinterpret_cast<const double*>(fileBytes + fileHeader->timesOffset);
+    const uint64_t* fileIndex = reinterpret_cast<const uint64_t*>(fileBytes + fileHeader->indexOffset);
+    for (uint64_t frame = 0; valid && frame < fileHeader->frameCount; frame++) {
+      valid = std::isfinite(fileTimes[frame]) && (frame == 0 || fileTimes[frame - 1] <= fileTimes[frame]);
+    }
+    for (uint64_t i = 0; valid && i < fileHeader->indexCount; i++) {
+      valid = fileIndex[i] < fileHeader->frameCount;
+    }
+  }
+  if (!valid) {
+    unmap();
+    return false;
+  }
+
+  const char* bytes = static_cast<const char*>(mapping);
+  header = fileHeader;
+  times = reinterpret_cast<const double*>(bytes + header->timesOffset);
+  values = reinterpret_cast<const float*>(bytes + header->valuesOffset);
+  index = reinterpret_cast<const uint64_t*>(bytes + header->indexOffset);
+  // frames are read in time order when rendering
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  return true;
+}
+
+size_t MappedAnalysisRecording::frameAt(double time) const {
+  if (time <= 0.0) return index[0];
+  size_t entry = std::min<uint64_t>(header->indexCount - 1, static_cast<uint64_t>(time / header->indexInterval));
+  size_t frame = index[entry];
+  while (frame + 1 < header->frameCount && times[frame + 1] <= time) frame++;
+  return frame;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "AnalysisRecording.h"
+
+// Analysis recording in a binary columnar file (.oscb) that is memory-mapped rather than read, so
+// opening an hour-long session is instant and only the pages actually used are ever loaded.
+//
+// Layout, native endian, every section 8-byte aligned:
+//   Header
+//   double times[frameCount]                    seconds, ascending
+//   float  values[scalarCount][frameCount]      one column per scalar
+//   uint64 index[indexCount]                    index[i] = last frame at or before i * indexInterval
+// The index makes frameAt() a lookup plus a step or two, wherever in the session it seeks to.
+class MappedAnalysisRecording : public AnalysisRecording {
+
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t scalarCount;
+    uint64_t frameCount;
+    double indexInterval; // seconds
+    uint64_t indexCount;
+    uint64_t timesOffset;
+    uint64_t valuesOffset;
+    uint64_t indexOffset;
+  };
+
+  static bool write(const AnalysisRecording& recording, const std::string& path);
+
+  MappedAnalysisRecording() = default;
+  ~MappedAnalysisRecording();
+  MappedAnalysisRecording(const MappedAnalysisRecording&) = delete;
+  MappedAnalysisRecording& operator=(const MappedAnalysisRecording&) = delete;
+
+  bool load(const std::string& path);
+
+  size_t size() const override { return header ? header->frameCount : 0; }
+  size_t getScalarCount() const override { return header ? header->scalarCount : 0; }
+  double getTime(size_t frame) const override { return times[frame]; }
+  float getScalar(size_t frame, size_t scalar) const override { return values[scalar * header->frameCount + frame]; }
+  size_t frameAt(double time) const override;
+
+  // Contiguous column of one scalar for every frame
+  const float* getColumn(size_t scalar) const { return values + scalar * header->frameCount; }
+
+private:
+  void unmap();
+
+  void* mapping { nullptr };
+  size_t mappingSize { 0 };
+  const Header* header { nullptr };
+  const double* times { nullptr };
+  const float* values { nullptr };
+  const uint64_t* index { nullptr };
+};
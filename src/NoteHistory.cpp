@@ -0,0 +1,51 @@
+#include "NoteHistory.h"
+#include <algorithm>
+#include <cassert>
+
+NoteHistory::NoteHistory(size_t capacity_) :
+capacity { capacity_ }
+{
+  assert(capacity > 0);
+  reserve();
+}
+
+void NoteHistory::reserve() {
+  xys.reserve(capacity);
+  times.reserve(capacity);
+  kurtoses.reserve(capacity);
+  centroids.reserve(capacity);
+}
+
+size_t NoteHistory::add(float x, float y, float time, float kurtosis, float centroid) {
+  size_t slot = nextSlot;
+  if (isFull()) {
+    xys[slot] = { x, y };
+    times[slot] = time;
+    kurtoses[slot] = kurtosis;
+    centroids[slot] = centroid;
+  } else {
+    xys.push_back({ x, y });
+    times.push_back(time);
+    kurtoses.push_back(kurtosis);
+    centroids.push_back(centroid);
+  }
+  nextSlot = (slot + 1) % capacity;
+  return slot;
+}
+
+void NoteHistory::setCapacity(size_t capacity_) {
+  assert(capacity_ > 0);
+  if (capacity_ == capacity) return;
+
+  // oldest note is at nextSlot once full, otherwise at 0
+  size_t oldestSlot = isFull() ? nextSlot : 0;
+  size_t keep = std::min(size(), capacity_);
+  size_t firstKept = size() - keep;
+
+  NoteHistory resized { capacity_ };
+  for (size_t i = firstKept; i < size(); i++) {
+    size_t slot = (oldestSlot + i) % size();
+    resized.add(xys[slot][0], xys[slot][1], times[slot], kurtoses[slot], centroids[slot]);
+  }
+  *this = std::move(resized);
+}
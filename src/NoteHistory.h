@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Fixed-capacity history of recent notes. Once full, each new note overwrites the oldest one, so
+// a note keeps the same slot index for as long as it is in the history. Columns are stored
+// separately (xys, times, kurtoses, centroids), each contiguous and indexed by slot; xys is in the
+// layout dkm clusters over so it can be passed straight through.
+class NoteHistory {
+
+public:
+  explicit NoteHistory(size_t capacity);
+
+  // Keeps the newest notes that fit. Slots are renumbered oldest first, so anything indexed by
+  // slot (e.g. cluster labels) has to be rebuilt afterwards.
+  void setCapacity(size_t capacity);
+  size_t getCapacity() const { return capacity; }
+
+  size_t size() const { return xys.size(); }
+  bool isFull() const { return size() == capacity; }
+
+  // Slot the next add() writes to. When full this holds the oldest note, which add() evicts.
+  size_t getNextSlot() const { return nextSlot; }
+
+  // Returns the slot the note was written to
+  size_t add(float x, float y, float time, float kurtosis, float centroid);
+
+  const std::vector<std::array<float, 2>>& getXYs() const { return xys; }
+  const std::array<float, 2>& getXY(size_t slot) const { return xys[slot]; }
+  float getTime(size_t slot) const { return times[slot]; }
+  float getKurtosis(size_t slot) const { return kurtoses[slot]; }
+  float getCentroid(size_t slot) const { return centroids[slot]; }
+
+private:
+  size_t capacity;
+  size_t nextSlot { 0 };
+  std::vector<std::array<float, 2>> xys;
+  std::vector<float> times;
+  std::vector<float> kurtoses;
+  std::vector<float> centroids;
+  
+  void reserve();
+};
@@ -0,0 +1,64 @@
+#include "OscsReader.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+// Numeric fields of one line, skipping OSC addresses
+void parseFields(const std::string& line, std::vector<double>& fields) {
+  fields.clear();
+  const char* p = line.c_str();
+  while (*p) {
+    while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r') p++;
+    if (!*p) break;
+    if (*p == '/') {
+      while (*p && *p != ' ' && *p != '\t' && *p != ',') p++;
+      continue;
+    }
+    char* end;
+    double value = std::strtod(p, &end);
+    if (end == p) {
+      // not a number: skip the field
+      while (*p && *p != ' ' && *p != '\t' && *p != ',') p++;
+      continue;
+    }
+    fields.push_back(value);
+    p = end;
+  }
+}
+
+}
+
+bool OscsReader::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) return false;
+
+  times.clear();
+  std::vector<std::vector<float>> rows;
+  size_t minScalarCount = std::numeric_limits<size_t>::max();
+  std::string line;
+  std::vector<double> fields;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    parseFields(line, fields);
+    if (fields.size() < 2) continue;
+    times.push_back(fields[0] / 1000.0);
+    rows.emplace_back(fields.begin() + 1, fields.end());
+    minScalarCount = std::min(minScalarCount, rows.back().size());
+  }
+  if (times.empty()) return false;
+
+  scalarCount = minScalarCount;
+  scalars.resize(times.size() * scalarCount);
+  for (size_t i = 0; i < rows.size(); i++) {
+    std::copy_n(rows[i].begin(), scalarCount, scalars.begin() + i * scalarCount);
+  }
+  return true;
+}
+
+size_t OscsReader::frameAt(double time) const {
+  auto it = std::upper_bound(times.begin(), times.end(), time);
+  return (it == times.begin()) ? 0 : (it - times.begin()) - 1;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "AnalysisRecording.h"
+
+// Reads a recorded .oscs analysis stream straight from disk for batch rendering, without playing
+// it back through ofxAudioAnalysisClient::FileClient, so a session renders as fast as frames can
+// be drawn. Parsing an hour of text takes a while, so convert sessions that are rendered more than
+// once with MappedAnalysisRecording::write.
+//
+// Assumed layout (the recorder's format isn't documented anywhere we have):
+// - plain text, one analysis frame per line; blank lines and lines starting with '#' are skipped
+// - fields separated by whitespace and/or commas; fields starting with '/' (OSC addresses) are skipped
+// - the first numeric field is the time in milliseconds since the recording started
+// - the remaining numeric fields are the scalars, in ofxAudioAnalysisClient::AnalysisScalar order,
+//   followed by anything else the recorder wrote (which is ignored if shorter rows follow)
+// Rows must be in time order. Every row keeps the same number of scalars as the shortest row.
+class OscsReader : public AnalysisRecording {
+
+public:
+  bool load(const std::string& path);
+
+  size_t size() const override { return times.size(); }
+  size_t getScalarCount() const override { return scalarCount; }
+  double getTime(size_t frame) const override { return times[frame]; }
+  float getScalar(size_t frame, size_t scalar) const override { return scalars[frame * scalarCount + scalar]; }
+  size_t frameAt(double time) const override;
+
+private:
+  std::vector<double> times; // seconds
+  std::vector<float> scalars; // scalarCount per frame
+  size_t scalarCount { 0 };
+};
@@ -0,0 +1,240 @@
+#include "SelfOrganizingMap.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include "Xoshiro256.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOM_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SOM_NEON 1
+#endif
+
+namespace {
+
+// Rows are searched in fixed-size blocks whatever the thread count, and the block results reduced
+// in order, so the best-matching node doesn't depend on how many threads are used
+constexpr size_t ROWS_PER_BLOCK = 16;
+
+// Neighbourhoods smaller than this many nodes aren't worth handing to the thread pool
+constexpr size_t PARALLEL_NEIGHBOURHOOD_NODES = 16384;
+
+// Closest node in [begin, end) to the instance by squared distance, lowest index on ties
+void closestNode(const float* w0, const float* w1, const float* w2, size_t begin, size_t end,
+                 const SelfOrganizingMap::Instance& instance, float& bestDistance, size_t& bestNode) {
+  size_t i = begin;
+  float best = std::numeric_limits<float>::infinity();
+  size_t bestIndex = begin;
+#if SOM_SSE2
+  {
+    const __m128 a = _mm_set1_ps(instance[0]);
+    const __m128 b = _mm_set1_ps(instance[1]);
+    const __m128 c = _mm_set1_ps(instance[2]);
+    __m128 bestLanes = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128i bestLaneIndices = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+    size_t lanesBegin = i;
+    for (; i + 4 <= end; i += 4) {
+      __m128 d0 = _mm_sub_ps(a, _mm_loadu_ps(w0 + i));
+      __m128 d1 = _mm_sub_ps(b, _mm_loadu_ps(w1 + i));
+      __m128 d2 = _mm_sub_ps(c, _mm_loadu_ps(w2 + i));
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2));
+      __m128 closer = _mm_cmplt_ps(d, bestLanes);
+      __m128i closerI = _mm_castps_si128(closer);
+      bestLanes = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, bestLanes));
+      bestLaneIndices = _mm_or_si128(_mm_and_si128(closerI, index), _mm_andnot_si128(closerI, bestLaneIndices));
+      index = _mm_add_epi32(index, step);
+    }
+    alignas(16) float lanes[4];
+    alignas(16) int32_t laneIndices[4];
+    _mm_store_ps(lanes, bestLanes);
+    _mm_store_si128(reinterpret_cast<__m128i*>(laneIndices), bestLaneIndices);
+    for (int j = 0; j < 4; j++) {
+      size_t node = lanesBegin + laneIndices[j];
+      if (lanes[j] < best || (lanes[j] == best && node < bestIndex)) {
+        best = lanes[j];
+        bestIndex = node;
+      }
+    }
+  }
+#elif SOM_NEON
+  {
+    const float32x4_t a = vdupq_n_f32(instance[0]);
+    const float32x4_t b = vdupq_n_f32(instance[1]);
+    const float32x4_t c = vdupq_n_f32(instance[2]);
+    float32x4_t bestLanes = vdupq_n_f32(std::numeric_limits<float>::infinity());
+    uint32x4_t bestLaneIndices = vdupq_n_u32(0);
+    const uint32_t indexInit[4] = { 0, 1, 2, 3 };
+    uint32x4_t index = vld1q_u32(indexInit);
+    const uint32x4_t step = vdupq_n_u32(4);
+    size_t lanesBegin = i;
+    for (; i + 4 <= end; i += 4) {
+      float32x4_t d0 = vsubq_f32(a, vld1q_f32(w0 + i));
+      float32x4_t d1 = vsubq_f32(b, vld1q_f32(w1 + i));
+      float32x4_t d2 = vsubq_f32(c, vld1q_f32(w2 + i));
+      float32x4_t d = vaddq_f32(vaddq_f32(vmulq_f32(d0, d0), vmulq_f32(d1, d1)), vmulq_f32(d2, d2));
+      uint32x4_t closer = vcltq_f32(d, bestLanes);
+      bestLanes = vbslq_f32(closer, d, bestLanes);
+      bestLaneIndices = vbslq_u32(closer, index, bestLaneIndices);
+      index = vaddq_u32(index, step);
+    }
+    float lanes[4];
+    uint32_t laneIndices[4];
+    vst1q_f32(lanes, bestLanes);
+    vst1q_u32(laneIndices, bestLaneIndices);
+    for (int j = 0; j < 4; j++) {
+      size_t node = lanesBegin + laneIndices[j];
+      if (lanes[j] < best || (lanes[j] == best && node < bestIndex)) {
+        best = lanes[j];
+        bestIndex = node;
+      }
+    }
+  }
+#endif
+  for (; i < end; i++) {
+    float d0 = instance[0] - w0[i];
+    float d1 = instance[1] - w1[i];
+    float d2 = instance[2] - w2[i];
+    float d = d0 * d0 + d1 * d1 + d2 * d2;
+    if (d < best) {
+      best = d;
+      bestIndex = i;
+    }
+  }
+  bestDistance = best;
+  bestNode = bestIndex;
+}
+
+}
+
+void SelfOrganizingMap::Region::include(const Region& other) {
+  if (other.isEmpty()) return;
+  if (isEmpty()) {
+    *this = other;
+    return;
+  }
+  x0 = std::min(x0, other.x0);
+  y0 = std::min(y0, other.y0);
+  x1 = std::max(x1, other.x1);
+  y1 = std::max(y1, other.y1);
+}
+
+void SelfOrganizingMap::setMapSize(size_t width_, size_t height_) {
+  width = width_;
+  height = height_;
+}
+
+void SelfOrganizingMap::setup(uint64_t seed) {
+  assert(width > 0 && height > 0);
+  mapRadius = std::max(width, height) / 2.0;
+  timeConstant = numIterations / std::log(mapRadius);
+  iteration = 0;
+  
+  Xoshiro256 randomEngine { seed };
+  for (auto& featureWeights : weights) {
+    featureWeights.resize(width * height);
+    for (auto& w : featureWeights) w = randomEngine.uniform();
+  }
+  changedRegion = { 0, 0, width, height };
+}
+
+SelfOrganizingMap::Region SelfOrganizingMap::takeChangedRegion() {
+  Region region = changedRegion;
+  changedRegion = { 0, 0, 0, 0 };
+  return region;
+}
+
+size_t SelfOrganizingMap::findBestMatchingNode(const Instance& instance) {
+  size_t blockCount = (height + ROWS_PER_BLOCK - 1) / ROWS_PER_BLOCK;
+  blockDistances.resize(blockCount);
+  blockNodes.resize(blockCount);
+  threadPool.parallel_for(blockCount, [&](size_t block) {
+    size_t begin = block * ROWS_PER_BLOCK * width;
+    size_t end = std::min(height, (block + 1) * ROWS_PER_BLOCK) * width;
+    closestNode(weights[0].data(), weights[1].data(), weights[2].data(), begin, end, instance, blockDistances[block], blockNodes[block]);
+  });
+  size_t bestBlock = 0;
+  for (size_t block = 1; block < blockCount; block++) {
+    if (blockDistances[block] < blockDistances[bestBlock]) bestBlock = block;
+  }
+  return blockNodes[bestBlock];
+}
+
+void SelfOrganizingMap::updateMap(const Instance& instance) {
+  size_t bestNode = findBestMatchingNode(instance);
+  float t = std::min(iteration, numIterations);
+  float radius = mapRadius * std::exp(-t / timeConstant);
+  float learningRate = initialLearningRate * std::exp(-t / numIterations);
+  updateNeighbourhood(instance, bestNode, radius, learningRate);
+  iteration++;
+}
+
+void SelfOrganizingMap::updateNeighbourhood(const Instance& instance, size_t bestNode, float radius, float learningRate) {
+  // Nodes inside the radius move by learningRate * exp(-d^2 / (2 radius^2)). That factor is separable
+  // in x and y, so precalculate it along each axis of the window, which is also trimmed to where
+  // the change is above the cutoff.
+  float reach = radius;
+  if (neighbourhoodCutoff > 0.0) {
+    if (learningRate <= neighbourhoodCutoff) return;
+    reach = std::min(reach, radius * std::sqrt(2.0f * std::log(learningRate / neighbourhoodCutoff)));
+  }
+  const float radiusSquared = radius * radius;
+  const float reachSquared = reach * reach;
+  const int bestX = bestNode % width;
+  const int bestY = bestNode / width;
+  const int extent = std::ceil(reach);
+  const int x0 = std::max(0, bestX - extent);
+  const int x1 = std::min<int>(width - 1, bestX + extent);
+  const int y0 = std::max(0, bestY - extent);
+  const int y1 = std::min<int>(height - 1, bestY + extent);
+  
+  changedRegion.include({ size_t(x0), size_t(y0), size_t(x1 + 1), size_t(y1 + 1) });
+  
+  influenceX.resize(x1 - x0 + 1);
+  for (int x = x0; x <= x1; x++) {
+    float dx = x - bestX;
+    influenceX[x - x0] = std::exp(-dx * dx / (2.0f * radiusSquared));
+  }
+  influenceY.resize(y1 - y0 + 1);
+  for (int y = y0; y <= y1; y++) {
+    float dy = y - bestY;
+    influenceY[y - y0] = learningRate * std::exp(-dy * dy / (2.0f * radiusSquared));
+  }
+  
+  auto updateRow = [&](size_t row) {
+    int y = y0 + row;
+    float dy = y - bestY;
+    float dySquared = dy * dy;
+    if (dySquared >= reachSquared) return;
+    // x range of the disc on this row
+    int halfWidth = std::ceil(std::sqrt(reachSquared - dySquared));
+    int rowX0 = std::max(x0, bestX - halfWidth);
+    int rowX1 = std::min(x1, bestX + halfWidth);
+    float rowInfluence = influenceY[row];
+    for (size_t f = 0; f < FEATURES; f++) {
+      float* w = weights[f].data() + y * width;
+      float target = instance[f];
+      for (int x = rowX0; x <= rowX1; x++) {
+        float dx = x - bestX;
+        if (dx * dx + dySquared >= reachSquared) continue;
+        w[x] += rowInfluence * influenceX[x - x0] * (target - w[x]);
+      }
+    }
+  };
+  
+  size_t rows = y1 - y0 + 1;
+  if (rows * (x1 - x0 + 1) >= PARALLEL_NEIGHBOURHOOD_NODES) {
+    threadPool.parallel_for(rows, updateRow);
+  } else {
+    for (size_t row = 0; row < rows; row++) updateRow(row);
+  }
+}
+
+SelfOrganizingMap::Instance SelfOrganizingMap::getMapAt(size_t x, size_t y) const {
+  size_t node = std::min(y, height - 1) * width + std::min(x, width - 1);
+  return { weights[0][node], weights[1][node], weights[2][node] };
+}
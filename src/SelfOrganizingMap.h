@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <random>
+#include <vector>
+#include "dkm_parallel.hpp"
+
+// 2D self-organising map of 3-feature nodes, trained the same way as ofxSelfOrganizingMap (features
+// in [0, 1]). Weights are stored as one contiguous float array per feature so the best-matching-unit
+// search can be vectorised and split across threads, and each update only visits the nodes inside
+// the current neighbourhood radius rather than the whole map.
+class SelfOrganizingMap {
+
+public:
+  static constexpr size_t FEATURES = 3;
+  using Instance = std::array<float, FEATURES>;
+  
+  // Half-open node rectangle [x0, x1) x [y0, y1)
+  struct Region {
+    size_t x0, y0, x1, y1;
+    bool isEmpty() const { return x0 >= x1 || y0 >= y1; }
+    void include(const Region& other);
+  };
+  
+  void setMapSize(size_t width, size_t height);
+  void setInitialLearningRate(float initialLearningRate_) { initialLearningRate = initialLearningRate_; }
+  // Learning rate and neighbourhood radius decay over this many updates and then hold
+  void setNumIterations(size_t numIterations_) { numIterations = numIterations_; }
+  // Skip neighbourhood nodes whose weight change would be smaller than this fraction of the difference
+  void setNeighbourhoodCutoff(float neighbourhoodCutoff_) { neighbourhoodCutoff = neighbourhoodCutoff_; }
+  void setThreadCount(size_t threadCount) { threadPool.set_thread_count(threadCount); }
+  void setup(uint64_t seed = std::random_device()());
+  
+  void updateMap(const Instance& instance);
+  size_t findBestMatchingNode(const Instance& instance);
+  Instance getMapAt(size_t x, size_t y) const;
+
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+  const float* getWeights(size_t feature) const { return weights[feature].data(); }
+  // Nodes changed since the last call (the whole map after setup), and start tracking afresh
+  Region takeChangedRegion();
+
+private:
+  size_t width { 0 };
+  size_t height { 0 };
+  float initialLearningRate { 0.1 };
+  size_t numIterations { 3000 };
+  float neighbourhoodCutoff { 0.0 };
+  
+  float mapRadius;
+  float timeConstant;
+  size_t iteration;
+  
+  std::array<std::vector<float>, FEATURES> weights;
+  Region changedRegion { 0, 0, 0, 0 };
+  
+  dkm::thread_pool threadPool { 1 };
+  // scratch space
+  std::vector<float> blockDistances;
+  std::vector<size_t> blockNodes;
+  std::vector<float> influenceX;
+  std::vector<float> influenceY;
+  
+  void updateNeighbourhood(const Instance& instance, size_t bestNode, float radius, float learningRate);
+};
@@ -0,0 +1,79 @@
+#include "SnapshotExporter.h"
+
+bool SnapshotExporter::start(const std::string& path_, const ofFbo& composite_, uint32_t width_, uint32_t height_) {
+  if (isExporting()) return false;
+  if (!writer.start(path_, width_, height_, TILE_SIZE)) return false;
+
+  if (!tileFbos[0].isAllocated()) {
+    for (size_t i = 0; i < TILES_PER_FRAME; i++) {
+      tileFbos[i].allocate(TILE_SIZE, TILE_SIZE, GL_RGB);
+      tileBuffers[i].allocate(TILE_SIZE * TILE_SIZE * 3, GL_STREAM_READ);
+    }
+  }
+
+  composite = &composite_;
+  writing = true;
+  path = path_;
+  width = width_;
+  height = height_;
+  nextTile = 0;
+  tileCount = writer.getTilesAcross() * writer.getTilesDown();
+  startMillis = ofGetSystemTimeMillis();
+  return true;
+}
+
+void SnapshotExporter::update() {
+  if (composite) {
+    readTiles();
+    if (nextTile < tileCount) {
+      renderTiles();
+    } else {
+      composite = nullptr;
+      writer.finish();
+    }
+  } else if (writing && !writer.isBusy()) {
+    writing = false;
+    if (writer.hasFailed()) {
+      ofLogError() << "snapshot: can't write " << path;
+    } else {
+      ofLogNotice() << "snapshot: " << width << "x" << height << " written to " << path << " in " << (ofGetSystemTimeMillis() - startMillis) / 1000.0 << "s";
+    }
+  }
+}
+
+// Tiles rendered last frame
+void SnapshotExporter::readTiles() {
+  for (size_t i = 0; i < TILES_PER_FRAME; i++) {
+    Readback& readback = readbacks[i];
+    if (!readback.pending) continue;
+    const uint8_t* mapped = tileBuffers[i].map<uint8_t>(GL_READ_ONLY);
+    if (mapped) {
+      writer.addTile(readback.tileX, readback.tileY, std::vector<uint8_t>(mapped, mapped + TILE_SIZE * TILE_SIZE * 3));
+    }
+    tileBuffers[i].unmap();
+    readback.pending = false;
+  }
+}
+
+void SnapshotExporter::renderTiles() {
+  const uint32_t tilesAcross = writer.getTilesAcross();
+  const float scaleX = composite->getWidth() / width; // composite pixels per output pixel
+  const float scaleY = composite->getHeight() / height;
+  for (size_t i = 0; i < TILES_PER_FRAME && nextTile < tileCount; i++, nextTile++) {
+    Readback& readback = readbacks[i];
+    readback.tileX = nextTile % tilesAcross;
+    readback.tileY = nextTile / tilesAcross;
+
+    tileFbos[i].begin();
+    ofClear(0, 255);
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+    ofSetColor(255);
+    composite->getTexture().drawSubsection(0.0, 0.0, TILE_SIZE, TILE_SIZE,
+                                           readback.tileX * TILE_SIZE * scaleX, readback.tileY * TILE_SIZE * scaleY,
+                                           TILE_SIZE * scaleX, TILE_SIZE * scaleY);
+    tileFbos[i].end();
+
+    tileFbos[i].getTexture().copyTo(tileBuffers[i]); // starts the transfer without waiting for it
+    readback.pending = true;
+  }
+}
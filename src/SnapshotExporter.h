@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ofMain.h"
+#include "TiffTileWriter.h"
+
+// Exports a composited canvas as a tiled TIFF a few tiles per frame, so the show keeps running.
+// Each tile is drawn from the composite at the output scale into a small reused fbo and copied
+// into a pixel buffer object; it's mapped a frame later, once the GPU has finished, and handed to
+// a TiffTileWriter thread. Only tiles are ever rendered, so the output can be larger than the GL
+// maximum texture size.
+class SnapshotExporter {
+
+public:
+  static constexpr uint32_t TILE_SIZE = 1024;
+  static constexpr size_t TILES_PER_FRAME = 2;
+
+  // The composite mustn't change until isExporting() is false
+  bool start(const std::string& path, const ofFbo& composite, uint32_t width, uint32_t height);
+  void update();
+  bool isExporting() const { return composite || writing; }
+
+private:
+  struct Readback {
+    bool pending { false };
+    uint32_t tileX, tileY;
+  };
+
+  const ofFbo* composite { nullptr };
+  bool writing { false };
+  std::string path;
+  uint32_t width, height;
+  uint32_t nextTile, tileCount;
+  uint64_t startMillis;
+  TiffTileWriter writer;
+  std::array<ofFbo, TILES_PER_FRAME> tileFbos;
+  std::array<ofBufferObject, TILES_PER_FRAME> tileBuffers;
+  std::array<Readback, TILES_PER_FRAME> readbacks;
+
+  void readTiles();
+  void renderTiles();
+};
@@ -0,0 +1,59 @@
+#include "SomColorTable.h"
+#include <algorithm>
+#include <cmath>
+
+void SomColorTable::sync(SelfOrganizingMap& som) {
+  sync(som, som.takeChangedRegion());
+}
+
+void SomColorTable::sync(const SelfOrganizingMap& som, SelfOrganizingMap::Region region) {
+  if (som.getWidth() != width || som.getHeight() != height) {
+    width = som.getWidth();
+    height = som.getHeight();
+    colors.resize(width * height);
+    region = { 0, 0, width, height };
+  }
+  if (region.isEmpty()) return;
+
+  const float* w0 = som.getWeights(0);
+  const float* w1 = som.getWeights(1);
+  const float* w2 = som.getWeights(2);
+  for (size_t y = region.y0; y < region.y1; y++) {
+    size_t node = y * width + region.x0;
+    size_t rowEnd = y * width + region.x1;
+    for (; node < rowEnd; node++) {
+      colors[node] = { w0[node], w1[node], w2[node], 1.0 };
+    }
+  }
+}
+
+SomColorTable::Color SomColorTable::colorAt(float x, float y) const {
+  if (colors.empty()) return { 0.0, 0.0, 0.0, 1.0 };
+
+  float fx = std::clamp(x * width - 0.5f, 0.0f, float(width - 1));
+  float fy = std::clamp(y * height - 0.5f, 0.0f, float(height - 1));
+  size_t x0 = fx;
+  size_t y0 = fy;
+  size_t x1 = std::min(x0 + 1, width - 1);
+  size_t y1 = std::min(y0 + 1, height - 1);
+  float ax = fx - x0;
+  float ay = fy - y0;
+
+  const Color& c00 = colors[y0 * width + x0];
+  const Color& c10 = colors[y0 * width + x1];
+  const Color& c01 = colors[y1 * width + x0];
+  const Color& c11 = colors[y1 * width + x1];
+  Color result;
+  for (size_t i = 0; i < 4; i++) {
+    float top = c00[i] + ax * (c10[i] - c00[i]);
+    float bottom = c01[i] + ax * (c11[i] - c01[i]);
+    result[i] = top + ay * (bottom - top);
+  }
+  return result;
+}
+
+void SomColorTable::colorsAt(const Point* points, size_t count, Color* colorsOut) const {
+  for (size_t i = 0; i < count; i++) {
+    colorsOut[i] = colorAt(points[i][0], points[i][1]);
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "SelfOrganizingMap.h"
+
+// RGBA colours for every node of a SelfOrganizingMap, packed one node after another so a lookup
+// touches one contiguous 16 byte colour rather than three feature arrays. sync() only copies the
+// nodes the map changed since the last sync, which after the first few seconds of training is a
+// small window around each best-matching node.
+class SomColorTable {
+
+public:
+  using Point = std::array<float, 2>;
+  using Color = std::array<float, 4>;
+
+  void sync(SelfOrganizingMap& som);
+  // Copy a region the caller has been tracking, for when several tables follow one map
+  void sync(const SelfOrganizingMap& som, SelfOrganizingMap::Region region);
+
+  // Bilinear between node centres; x and y in [0, 1] and clamped to the map edges
+  Color colorAt(float x, float y) const;
+  void colorsAt(const Point* points, size_t count, Color* colorsOut) const;
+
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+
+private:
+  size_t width { 0 };
+  size_t height { 0 };
+  std::vector<Color> colors;
+};
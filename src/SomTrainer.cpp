@@ -0,0 +1,107 @@
+#include "SomTrainer.h"
+
+SomTrainer::~SomTrainer() {
+  stop();
+}
+
+void SomTrainer::setup(size_t width, size_t height, float initialLearningRate, size_t numIterations, uint64_t seed) {
+  stop();
+  som.setMapSize(width, height);
+  som.setInitialLearningRate(initialLearningRate);
+  som.setNumIterations(numIterations);
+  som.setup(seed);
+  SelfOrganizingMap::Region changed = som.takeChangedRegion();
+  for (size_t i = 0; i < SNAPSHOT_TABLES; i++) {
+    tables[i] = std::make_shared<SomColorTable>();
+    tables[i]->sync(som, changed);
+    tableChangedRegions[i] = { 0, 0, 0, 0 };
+  }
+  std::atomic_store(&snapshot, std::shared_ptr<const SomColorTable>(tables[0]));
+  updatesSincePublish = 0;
+  if (async) start();
+}
+
+void SomTrainer::setAsync(bool async_) {
+  if (async_ == async) return;
+  async = async_;
+  if (async) {
+    start();
+  } else {
+    stop(); // trains whatever is still queued first
+  }
+}
+
+bool SomTrainer::add(const SelfOrganizingMap::Instance& instance) {
+  if (!async) {
+    train(instance);
+    publish();
+    return true;
+  }
+  if (!queue.push(instance)) {
+    droppedCount++;
+    return false;
+  }
+  // Taking the mutex orders this push against the training thread's check for an empty queue
+  // before it sleeps, so the notification can't be missed
+  { std::lock_guard<std::mutex> lock(wakeMutex); }
+  wakeCondition.notify_one();
+  return true;
+}
+
+void SomTrainer::start() {
+  if (trainingThread.joinable()) return;
+  stopping = false;
+  trainingThread = std::thread([this] { run(); });
+}
+
+void SomTrainer::stop() {
+  if (!trainingThread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    stopping = true;
+  }
+  wakeCondition.notify_one();
+  trainingThread.join();
+}
+
+void SomTrainer::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      wakeCondition.wait(lock, [this] { return stopping || !queue.isEmpty(); });
+      if (stopping && queue.isEmpty()) return;
+    }
+    SelfOrganizingMap::Instance instance;
+    while (queue.pop(instance)) {
+      train(instance);
+      if (updatesSincePublish >= publishInterval) publish();
+    }
+    publish();
+  }
+}
+
+void SomTrainer::train(const SelfOrganizingMap::Instance& instance) {
+  som.setThreadCount(threadCount);
+  som.setNeighbourhoodCutoff(neighbourhoodCutoff);
+  som.updateMap(instance);
+  updatesSincePublish++;
+  updateCount++;
+}
+
+void SomTrainer::publish() {
+  SelfOrganizingMap::Region changed = som.takeChangedRegion();
+  for (auto& region : tableChangedRegions) region.include(changed);
+  if (updatesSincePublish == 0) return;
+
+  // The published table and any the render thread still holds have other owners
+  for (size_t i = 0; i < SNAPSHOT_TABLES; i++) {
+    if (tables[i].use_count() != 1) continue;
+    std::atomic_thread_fence(std::memory_order_acquire); // the last reader has finished with it
+    tables[i]->sync(som, tableChangedRegions[i]);
+    tableChangedRegions[i] = { 0, 0, 0, 0 };
+    std::atomic_store(&snapshot, std::shared_ptr<const SomColorTable>(tables[i]));
+    updatesSincePublish = 0;
+    return;
+  }
+  // every table is in use, so try again after the next update
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include "SelfOrganizingMap.h"
+#include "SomColorTable.h"
+#include "SpscQueue.h"
+
+// Trains a SelfOrganizingMap away from the render thread. add() queues an instance on a lock-free
+// queue and returns; a training thread drains the queue, so bursts of notes are trained together,
+// and publishes an immutable SomColorTable snapshot for getSnapshot() at most every
+// publishInterval updates and whenever the queue runs dry. Snapshots rotate through a few
+// tables that are each brought up to date incrementally, and a table is only rewritten once
+// nobody holds it any more.
+//
+// With setAsync(false) add() trains and publishes on the calling thread instead, so a replay of
+// the same instances gives the same colours frame for frame.
+class SomTrainer {
+
+public:
+  ~SomTrainer();
+
+  void setup(size_t width, size_t height, float initialLearningRate, size_t numIterations, uint64_t seed = std::random_device()());
+  void setAsync(bool async);
+  void setPublishInterval(size_t updates) { publishInterval = std::max<size_t>(1, updates); }
+  void setThreadCount(size_t threadCount_) { threadCount = threadCount_; }
+  void setNeighbourhoodCutoff(float neighbourhoodCutoff_) { neighbourhoodCutoff = neighbourhoodCutoff_; }
+
+  // Returns false if the instance was dropped because the training thread is too far behind
+  bool add(const SelfOrganizingMap::Instance& instance);
+  std::shared_ptr<const SomColorTable> getSnapshot() const { return std::atomic_load(&snapshot); }
+
+  uint64_t getUpdateCount() const { return updateCount; }
+  uint64_t getDroppedCount() const { return droppedCount; }
+
+private:
+  static constexpr size_t QUEUE_CAPACITY = 1024;
+  static constexpr size_t SNAPSHOT_TABLES = 3;
+
+  SelfOrganizingMap som;
+  SpscQueue<SelfOrganizingMap::Instance> queue { QUEUE_CAPACITY };
+  std::array<std::shared_ptr<SomColorTable>, SNAPSHOT_TABLES> tables;
+  std::array<SelfOrganizingMap::Region, SNAPSHOT_TABLES> tableChangedRegions; // changes each table hasn't seen yet
+  std::shared_ptr<const SomColorTable> snapshot; // only accessed through atomic_load and atomic_store
+  size_t updatesSincePublish { 0 };
+
+  std::atomic<size_t> publishInterval { 4 };
+  std::atomic<size_t> threadCount { 1 };
+  std::atomic<float> neighbourhoodCutoff { 0.0 };
+  std::atomic<uint64_t> updateCount { 0 };
+  std::atomic<uint64_t> droppedCount { 0 };
+
+  bool async { false };
+  std::thread trainingThread;
+  std::mutex wakeMutex;
+  std::condition_variable wakeCondition;
+  bool stopping { false };
+
+  void start();
+  void stop();
+  void run();
+  void train(const SelfOrganizingMap::Instance& instance);
+  void publish();
+};
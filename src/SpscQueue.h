@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Capacity is
+// rounded up to a power of two. push() fails rather than blocks when the queue is full.
+template <typename T>
+class SpscQueue {
+
+public:
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    items.resize(size);
+    mask = size - 1;
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Producer only
+  bool push(const T& item) {
+    size_t tail = tailIndex.load(std::memory_order_relaxed);
+    if (tail - headIndex.load(std::memory_order_acquire) == items.size()) return false;
+    items[tail & mask] = item;
+    tailIndex.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only
+  bool pop(T& item) {
+    size_t head = headIndex.load(std::memory_order_relaxed);
+    if (head == tailIndex.load(std::memory_order_acquire)) return false;
+    item = items[head & mask];
+    headIndex.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool isEmpty() const {
+    return headIndex.load(std::memory_order_acquire) == tailIndex.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<T> items;
+  size_t mask;
+  // on separate cache lines so the two threads don't contend for one
+  alignas(64) std::atomic<size_t> headIndex { 0 };
+  alignas(64) std::atomic<size_t> tailIndex { 0 };
+};
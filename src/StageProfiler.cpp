@@ -0,0 +1,146 @@
+#include "StageProfiler.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+StageProfiler& StageProfiler::instance() {
+  static StageProfiler profiler;
+  return profiler;
+}
+
+uint64_t StageProfiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t StageProfiler::registerStage(const std::string& name, bool gpu) {
+  auto it = std::find_if(stages.begin(), stages.end(), [&name](const Stage& stage) { return stage.name == name; });
+  if (it != stages.end()) {
+    it->gpu = it->gpu || gpu;
+    return it - stages.begin();
+  }
+  stages.push_back({ name, gpu, 0, 0, 0, {}, {}, 0, 0, {} });
+  return stages.size() - 1;
+}
+
+void StageProfiler::beginFrame() {
+  enabled = requestedEnabled;
+  inFrame = enabled;
+  if (!enabled) return;
+  frame++;
+  if (gpuTimer) gpuTimer->collect(*this);
+  for (auto& stage : stages) {
+    stage.frameNanos = 0;
+    stage.frameCalls = 0;
+  }
+}
+
+void StageProfiler::endFrame() {
+  if (!inFrame) return;
+  inFrame = false;
+  for (auto& stage : stages) {
+    if (stage.frameCalls == 0) continue;
+    stage.cpuNanos.add(stage.frameNanos);
+    stage.calls.add(stage.frameCalls);
+  }
+}
+
+void StageProfiler::beginStage(size_t stage) {
+  if (!inFrame) return;
+  Stage& s = stages[stage];
+  if (s.gpu && gpuTimer && gpuTimer->isAvailable()) gpuTimer->begin(stage, frame);
+  s.startNanos = now();
+}
+
+void StageProfiler::endStage(size_t stage) {
+  if (!inFrame) return;
+  uint64_t endNanos = now();
+  Stage& s = stages[stage];
+  if (s.gpu && gpuTimer && gpuTimer->isAvailable()) gpuTimer->end(stage);
+  uint64_t duration = endNanos - s.startNanos;
+  s.frameNanos += duration;
+  s.frameCalls++;
+
+  if (events.size() < MAX_EVENTS) {
+    events.push_back({ stage, s.startNanos, duration });
+  } else {
+    events[eventCount % MAX_EVENTS] = { stage, s.startNanos, duration };
+  }
+  eventCount++;
+}
+
+// Samples arrive in the order they were issued, so a stage's frame is complete once one from a later frame turns up
+void StageProfiler::addGpuSample(size_t stage, uint64_t sampleFrame, uint64_t nanoseconds) {
+  Stage& s = stages[stage];
+  if (sampleFrame != s.gpuFrame) {
+    if (s.gpuFrameNanos > 0) s.gpuNanos.add(s.gpuFrameNanos);
+    s.gpuFrame = sampleFrame;
+    s.gpuFrameNanos = 0;
+  }
+  s.gpuFrameNanos += nanoseconds;
+}
+
+template <typename T>
+StageProfiler::Percentiles StageProfiler::percentiles(const Ring<T>& ring) {
+  size_t size = ring.size();
+  if (size == 0) return { 0.0, 0.0, 0.0, 0.0 };
+  std::vector<T> sorted(ring.values.begin(), ring.values.begin() + size);
+  std::sort(sorted.begin(), sorted.end());
+  auto rank = [&sorted, size](double p) {
+    size_t index = std::min(size - 1, static_cast<size_t>(p * size));
+    return sorted[index] / 1.0e6;
+  };
+  return { rank(0.50), rank(0.95), rank(0.99), sorted.back() / 1.0e6 };
+}
+
+std::vector<StageProfiler::Summary> StageProfiler::summarise() const {
+  std::vector<Summary> summaries;
+  for (const auto& stage : stages) {
+    size_t frames = stage.cpuNanos.size();
+    if (frames == 0) continue;
+    uint64_t calls = 0;
+    for (size_t i = 0; i < stage.calls.size(); i++) calls += stage.calls.values[i];
+    summaries.push_back({
+      stage.name,
+      frames,
+      static_cast<double>(calls) / stage.calls.size(),
+      percentiles(stage.cpuNanos),
+      stage.gpuNanos.size() > 0,
+      percentiles(stage.gpuNanos)
+    });
+  }
+  return summaries;
+}
+
+bool StageProfiler::writeCsv(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "stage,frames,callsPerFrame,cpuP50Ms,cpuP95Ms,cpuP99Ms,cpuMaxMs,gpuP50Ms,gpuP95Ms,gpuP99Ms,gpuMaxMs\n";
+  for (const auto& summary : summarise()) {
+    file << summary.name << "," << summary.frames << "," << summary.callsPerFrame << ","
+         << summary.cpu.p50 << "," << summary.cpu.p95 << "," << summary.cpu.p99 << "," << summary.cpu.max;
+    if (summary.hasGpu) {
+      file << "," << summary.gpu.p50 << "," << summary.gpu.p95 << "," << summary.gpu.p99 << "," << summary.gpu.max;
+    } else {
+      file << ",,,,";
+    }
+    file << "\n";
+  }
+  return static_cast<bool>(file);
+}
+
+bool StageProfiler::writeChromeTrace(const std::string& path) const {
+  std::ofstream file(path);
+  if (!file) return false;
+  size_t count = std::min(eventCount, MAX_EVENTS);
+  size_t first = eventCount - count;
+  uint64_t originNanos = count > 0 ? events[first % MAX_EVENTS].startNanos : 0;
+  file << "{\"traceEvents\":[\n";
+  for (size_t i = 0; i < count; i++) {
+    const Event& event = events[(first + i) % MAX_EVENTS];
+    file << (i == 0 ? "" : ",\n")
+         << "{\"name\":\"" << stages[event.stage].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+         << "\"ts\":" << (event.startNanos - originNanos) / 1000.0 << ",\"dur\":" << event.durationNanos / 1000.0 << "}";
+  }
+  file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return static_cast<bool>(file);
+}
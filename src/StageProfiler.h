@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class StageProfiler;
+
+// Times stages on the GPU for StageProfiler, e.g. with GL timer queries. Results arrive some frames
+// after the work was issued, so collect() hands over whatever has finished without waiting.
+class GpuStageTimer {
+
+public:
+  virtual ~GpuStageTimer() = default;
+  virtual bool isAvailable() const = 0;
+  virtual void begin(size_t stage, uint64_t frame) = 0;
+  virtual void end(size_t stage) = 0;
+  virtual void collect(StageProfiler& profiler) = 0;
+};
+
+// Scoped wall-clock timing of named stages, plus GPU time for stages that ask for it, kept over a
+// rolling window of frames so percentiles show the occasional slow frame as well as the typical one.
+// Use PROFILE_STAGE("name") or PROFILE_GPU_STAGE("name") at the top of a scope, and bracket each
+// frame with beginFrame() and endFrame(). Only the thread that calls beginFrame() may time stages.
+//
+// Disabled (the default), a stage costs one branch. setEnabled() takes effect at the next frame.
+class StageProfiler {
+
+public:
+  static constexpr size_t WINDOW_FRAMES = 512;
+
+  static StageProfiler& instance();
+
+  size_t registerStage(const std::string& name, bool gpu = false);
+
+  void setEnabled(bool enabled) { requestedEnabled = enabled; }
+  bool isEnabled() const { return enabled; }
+  void setGpuTimer(GpuStageTimer* gpuTimer_) { gpuTimer = gpuTimer_; }
+
+  void beginFrame();
+  void endFrame();
+  void beginStage(size_t stage);
+  void endStage(size_t stage);
+  void addGpuSample(size_t stage, uint64_t frame, uint64_t nanoseconds);
+
+  struct Percentiles {
+    double p50, p95, p99, max; // milliseconds
+  };
+  struct Summary {
+    std::string name;
+    size_t frames; // frames in the window where the stage ran
+    double callsPerFrame;
+    Percentiles cpu; // per frame, all calls in the frame added together
+    bool hasGpu;
+    Percentiles gpu; // per frame, as for cpu
+  };
+  std::vector<Summary> summarise() const;
+
+  bool writeCsv(const std::string& path) const;
+  // Chrome trace event JSON of the CPU stages in the window, for chrome://tracing or Perfetto
+  bool writeChromeTrace(const std::string& path) const;
+
+  class Scope {
+  public:
+    explicit Scope(size_t stage_) : stage { stage_ }, active { StageProfiler::instance().isEnabled() } {
+      if (active) StageProfiler::instance().beginStage(stage);
+    }
+    ~Scope() {
+      if (active) StageProfiler::instance().endStage(stage);
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  private:
+    size_t stage;
+    bool active;
+  };
+
+private:
+  template <typename T>
+  struct Ring {
+    std::array<T, WINDOW_FRAMES> values;
+    size_t count { 0 }; // total ever added
+    void add(T value) { values[count++ % WINDOW_FRAMES] = value; }
+    size_t size() const { return std::min(count, WINDOW_FRAMES); }
+  };
+
+  struct Stage {
+    std::string name;
+    bool gpu;
+    uint64_t startNanos;
+    uint64_t frameNanos;
+    uint32_t frameCalls;
+    Ring<uint64_t> cpuNanos;
+    Ring<uint32_t> calls;
+    uint64_t gpuFrame;
+    uint64_t gpuFrameNanos;
+    Ring<uint64_t> gpuNanos;
+  };
+
+  struct Event {
+    size_t stage;
+    uint64_t startNanos;
+    uint64_t durationNanos;
+  };
+  static constexpr size_t MAX_EVENTS = WINDOW_FRAMES * 64;
+
+  bool enabled { false };
+  bool requestedEnabled { false };
+  bool inFrame { false };
+  uint64_t frame { 0 };
+  GpuStageTimer* gpuTimer { nullptr };
+  std::vector<Stage> stages;
+  std::vector<Event> events; // ring of the most recent MAX_EVENTS
+  size_t eventCount { 0 };
+
+  static uint64_t now();
+  template <typename T>
+  static Percentiles percentiles(const Ring<T>& ring);
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_STAGE(name) \
+  static const size_t PROFILE_CONCAT(profileStage, __LINE__) = StageProfiler::instance().registerStage(name); \
+  StageProfiler::Scope PROFILE_CONCAT(profileScope, __LINE__) { PROFILE_CONCAT(profileStage, __LINE__) }
+// Also times the GL commands issued in the scope, when the GpuStageTimer can
+#define PROFILE_GPU_STAGE(name) \
+  static const size_t PROFILE_CONCAT(profileStage, __LINE__) = StageProfiler::instance().registerStage(name, true); \
+  StageProfiler::Scope PROFILE_CONCAT(profileScope, __LINE__) { PROFILE_CONCAT(profileStage, __LINE__) }
@@ -0,0 +1,147 @@
+#include "TiffTileWriter.h"
+#include <limits>
+
+namespace {
+
+enum TiffType : uint16_t { SHORT = 3, LONG = 4 };
+
+struct Field {
+  uint16_t tag;
+  TiffType type;
+  uint32_t count;
+  uint32_t value; // or the offset of the values when they don't fit in four bytes
+};
+
+template <typename T>
+void put(std::vector<uint8_t>& bytes, T value) {
+  for (size_t i = 0; i < sizeof(T); i++) bytes.push_back(static_cast<uint8_t>(value >> (8 * i))); // little endian
+}
+
+}
+
+TiffTileWriter::~TiffTileWriter() {
+  finish();
+  join();
+}
+
+void TiffTileWriter::join() {
+  if (writingThread.joinable()) writingThread.join();
+}
+
+bool TiffTileWriter::start(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize_) {
+  if (busy || width == 0 || height == 0 || tileSize_ == 0 || tileSize_ % 16 != 0) return false;
+  join();
+
+  tileSize = tileSize_;
+  tilesAcross = (width + tileSize - 1) / tileSize;
+  tilesDown = (height + tileSize - 1) / tileSize;
+
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file || !writeHeader(width, height)) {
+    file.close();
+    return false;
+  }
+
+  finishing = false;
+  failed = false;
+  busy = true;
+  writingThread = std::thread([this] { run(); });
+  return true;
+}
+
+// Header, one IFD, then the tile offset and byte count arrays, then the tiles in TIFF order
+bool TiffTileWriter::writeHeader(uint32_t width, uint32_t height) {
+  const uint64_t tileCount = uint64_t(tilesAcross) * tilesDown;
+  const uint64_t tileBytes = uint64_t(tileSize) * tileSize * 3;
+  const uint32_t fieldCount = 11;
+  const uint32_t ifdOffset = 8;
+  const uint32_t bitsPerSampleOffset = ifdOffset + 2 + fieldCount * 12 + 4;
+  const uint32_t tileOffsetsOffset = bitsPerSampleOffset + 3 * sizeof(uint16_t);
+  const uint64_t tileByteCountsOffset = tileOffsetsOffset + tileCount * sizeof(uint32_t);
+  dataOffset = (tileByteCountsOffset + tileCount * sizeof(uint32_t) + 15) & ~uint64_t(15);
+  if (dataOffset + tileCount * tileBytes > std::numeric_limits<uint32_t>::max()) return false;
+
+  // Single values sit in the field itself
+  auto arrayField = [tileCount](uint16_t tag, uint64_t offset, uint32_t single) {
+    return Field { tag, LONG, static_cast<uint32_t>(tileCount), tileCount == 1 ? single : static_cast<uint32_t>(offset) };
+  };
+  const Field fields[fieldCount] {
+    { 256, LONG, 1, width }, // ImageWidth
+    { 257, LONG, 1, height }, // ImageLength
+    { 258, SHORT, 3, bitsPerSampleOffset }, // BitsPerSample
+    { 259, SHORT, 1, 1 }, // Compression: none
+    { 262, SHORT, 1, 2 }, // PhotometricInterpretation: RGB
+    { 277, SHORT, 1, 3 }, // SamplesPerPixel
+    { 284, SHORT, 1, 1 }, // PlanarConfiguration: interleaved
+    { 322, LONG, 1, tileSize }, // TileWidth
+    { 323, LONG, 1, tileSize }, // TileLength
+    arrayField(324, tileOffsetsOffset, static_cast<uint32_t>(dataOffset)), // TileOffsets
+    arrayField(325, tileByteCountsOffset, static_cast<uint32_t>(tileBytes)) // TileByteCounts
+  };
+
+  std::vector<uint8_t> bytes;
+  bytes.insert(bytes.end(), { 'I', 'I' });
+  put<uint16_t>(bytes, 42);
+  put<uint32_t>(bytes, ifdOffset);
+  put<uint16_t>(bytes, fieldCount);
+  for (const auto& field : fields) {
+    put<uint16_t>(bytes, field.tag);
+    put<uint16_t>(bytes, field.type);
+    put<uint32_t>(bytes, field.count);
+    if (field.type == SHORT && field.count == 1) {
+      put<uint16_t>(bytes, field.value); // left justified in the four bytes
+      put<uint16_t>(bytes, 0);
+    } else {
+      put<uint32_t>(bytes, field.value);
+    }
+  }
+  put<uint32_t>(bytes, 0); // no next IFD
+  for (int i = 0; i < 3; i++) put<uint16_t>(bytes, 8);
+  if (tileCount > 1) {
+    for (uint64_t i = 0; i < tileCount; i++) put<uint32_t>(bytes, static_cast<uint32_t>(dataOffset + i * tileBytes));
+    for (uint64_t i = 0; i < tileCount; i++) put<uint32_t>(bytes, static_cast<uint32_t>(tileBytes));
+  }
+  bytes.resize(dataOffset, 0);
+  file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  return static_cast<bool>(file);
+}
+
+void TiffTileWriter::addTile(uint32_t tileX, uint32_t tileY, std::vector<uint8_t>&& pixels) {
+  {
+    std::lock_guard<std::mutex> lock(tilesMutex);
+    tiles.push_back({ tileX, tileY, std::move(pixels) });
+  }
+  tilesCondition.notify_one();
+}
+
+void TiffTileWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(tilesMutex);
+    finishing = true;
+  }
+  tilesCondition.notify_one();
+}
+
+void TiffTileWriter::run() {
+  const uint64_t tileBytes = uint64_t(tileSize) * tileSize * 3;
+  while (true) {
+    Tile tile;
+    {
+      std::unique_lock<std::mutex> lock(tilesMutex);
+      tilesCondition.wait(lock, [this] { return finishing || !tiles.empty(); });
+      if (tiles.empty()) break; // finishing
+      tile = std::move(tiles.front());
+      tiles.pop_front();
+    }
+    if (tile.x >= tilesAcross || tile.y >= tilesDown || tile.pixels.size() != tileBytes) {
+      failed = true;
+      continue;
+    }
+    file.seekp(dataOffset + (uint64_t(tile.y) * tilesAcross + tile.x) * tileBytes);
+    file.write(reinterpret_cast<const char*>(tile.pixels.data()), tileBytes);
+    if (!file) failed = true;
+  }
+  file.close();
+  if (file.fail()) failed = true;
+  busy = false;
+}
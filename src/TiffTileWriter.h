@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams an uncompressed 8-bit RGB tiled TIFF to disk from a background thread. Every tile has a
+// fixed place in the file, so tiles can be added in any order as they are rendered, and the
+// whole image is never held in memory. Tiles beyond the right and bottom edges are written
+// whole, as TIFF requires; readers crop them.
+class TiffTileWriter {
+
+public:
+  ~TiffTileWriter();
+
+  // False if the file can't be created, a previous image is still being written, or the image is
+  // too big for a classic (32 bit offset) TIFF. tileSize must be a multiple of 16.
+  bool start(const std::string& path, uint32_t width, uint32_t height, uint32_t tileSize);
+  // tileSize * tileSize * 3 bytes, rows top to bottom
+  void addTile(uint32_t tileX, uint32_t tileY, std::vector<uint8_t>&& pixels);
+  // Closes the file once the queued tiles are written, without waiting for them
+  void finish();
+
+  bool isBusy() const { return busy; }
+  bool hasFailed() const { return failed; }
+  uint32_t getTilesAcross() const { return tilesAcross; }
+  uint32_t getTilesDown() const { return tilesDown; }
+
+private:
+  struct Tile {
+    uint32_t x, y;
+    std::vector<uint8_t> pixels;
+  };
+
+  std::ofstream file;
+  uint32_t tileSize { 0 };
+  uint32_t tilesAcross { 0 };
+  uint32_t tilesDown { 0 };
+  uint64_t dataOffset { 0 };
+
+  std::thread writingThread;
+  std::mutex tilesMutex;
+  std::condition_variable tilesCondition;
+  std::deque<Tile> tiles;
+  bool finishing { false };
+  std::atomic<bool> busy { false };
+  std::atomic<bool> failed { false };
+
+  bool writeHeader(uint32_t width, uint32_t height);
+  void run();
+  void join();
+};
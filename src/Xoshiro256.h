@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// xoshiro256** seeded through splitmix64: a small, fast generator with a well-defined output for a
+// seed. The engine draws its indices and floats from it directly rather than through the standard
+// distributions, whose results differ between standard libraries, so a seed gives the same
+// drawing on every platform.
+class Xoshiro256 {
+
+public:
+  using result_type = uint64_t;
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  explicit Xoshiro256(uint64_t seed_ = 0) { seed(seed_); }
+
+  void seed(uint64_t seed) {
+    for (auto& s : state) {
+      // splitmix64
+      seed += 0x9E3779B97F4A7C15ull;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      s = z ^ (z >> 31);
+    }
+  }
+
+  result_type operator()() {
+    uint64_t result = rotl(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+    return result;
+  }
+
+  // Uniform in [0, count), by Lemire's multiply and shift with rejection of the biased low products
+  uint32_t index(uint32_t count) {
+    uint64_t product = uint64_t(uint32_t((*this)() >> 32)) * count;
+    if (uint32_t(product) < count) {
+      uint32_t threshold = uint32_t(-count) % count;
+      while (uint32_t(product) < threshold) product = uint64_t(uint32_t((*this)() >> 32)) * count;
+    }
+    return product >> 32;
+  }
+
+  // Uniform in [0, 1) from the top 24 bits
+  float uniform() {
+    return ((*this)() >> 40) * (1.0f / 16777216.0f);
+  }
+
+  // Uniform in [0, 1) from the top 53 bits, for weighted choices over large totals
+  double uniformDouble() {
+    return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+private:
+  uint64_t state[4];
+
+  static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+};
@@ -9,31 +9,75 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <random>
 #include <tuple>
 #include <type_traits>
 #include <vector>
+#include "Xoshiro256.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DKM_HAS_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define DKM_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
 
 /*
 DKM - A k-means implementation that is generic across variable data dimensions.
 */
 namespace dkm {
 
+/*
+Counters filled in by the accelerated algorithms, to show how much work the bounds saved.
+`lloyd_distance_evaluations` is the n * k point-to-mean distances per iteration that Lloyd's
+algorithm would have calculated, and `distance_evaluations_skipped` is how many of those weren't.
+Mean-to-mean distances needed for the bounds are included in `distance_evaluations`, so compare
+the skipped count with `lloyd_distance_evaluations` rather than the sum of the other two.
+*/
+struct kmeans_statistics {
+	uint64_t iterations = 0;
+	uint64_t distance_evaluations = 0;
+	uint64_t distance_evaluations_skipped = 0;
+	uint64_t lloyd_distance_evaluations = 0;
+};
+
 /*
 These functions are all private implementation details and shouldn't be referenced outside of this
 file.
 */
 namespace details {
 
+// An empty asm the compiler can't see through, so a product has to be rounded to a float before
+// it's used rather than fused into a multiply-add
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DKM_ROUND(value) __asm__("" : "+x"(value))
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define DKM_ROUND(value) __asm__("" : "+w"(value))
+#else
+#define DKM_ROUND(value) ((void)0) // MSVC doesn't contract unless asked to with /fp:contract
+#endif
+
+// DKM_ROUND for any coordinate type: integers are exact, and long double has no vector register
+template <typename T>
+inline void round_product(T&) {}
+inline void round_product(float& value) { DKM_ROUND(value); }
+inline void round_product(double& value) { DKM_ROUND(value); }
+
 /*
-Calculate the square of the distance between two points.
+Calculate the square of the distance between two points. Each square is rounded before it's added,
+as in the vectorised kernels, so the result doesn't depend on whether the compiler contracts.
 */
 template <typename T, size_t N>
 T distance_squared(const std::array<T, N>& point_a, const std::array<T, N>& point_b) {
 	T d_squared = T();
 	for (typename std::array<T, N>::size_type i = 0; i < N; ++i) {
 		auto delta = point_a[i] - point_b[i];
-		d_squared += delta * delta;
+		auto square = delta * delta;
+		round_product(square);
+		d_squared += square;
 	}
 	return d_squared;
 }
@@ -43,6 +87,187 @@ T distance(const std::array<T, N>& point_a, const std::array<T, N>& point_b) {
 	return std::sqrt(distance_squared(point_a, point_b));
 }
 
+template <typename T, size_t N>
+std::array<double, N> to_double(const std::array<T, N>& point) {
+	std::array<double, N> result;
+	for (size_t i = 0; i < N; ++i) {
+		result[i] = static_cast<double>(point[i]);
+	}
+	return result;
+}
+
+/*
+Vectorised nearest-mean search for 2-D float data, the common case of points on a plane.
+
+The means are transposed into separate x and y arrays and consecutive points are loaded into
+vector lanes (4 with SSE2, 8 with AVX2), so each mean is compared against a whole vector of points
+at once. Distances are computed in the same order as `distance_squared` ((px - mx)^2 + (py - my)^2)
+and means are visited in index order with a strict comparison, so the labels and distances match
+`closest_means_scalar` exactly, which is the fallback and also handles the points left over after
+the last whole vector. Both squares are rounded with DKM_ROUND before they're added, even where the
+compiler would otherwise fuse the multiply and add (GCC with -ffp-contract=fast, the default for
+GNU C++, fuses intrinsics too), as `distance_squared` rounds them, so `closest_mean` gives the same
+labels and distances. AVX2 is selected at runtime when the CPU supports it, then SSE2, then plain
+C++.
+*/
+namespace simd {
+
+struct means_2d {
+	std::vector<float> x;
+	std::vector<float> y;
+	size_t size() const { return x.size(); }
+};
+
+inline float sum_of_squares(float dx, float dy) {
+	float xx = dx * dx;
+	float yy = dy * dy;
+	DKM_ROUND(xx);
+	DKM_ROUND(yy);
+	return xx + yy;
+}
+
+inline void transpose_means(const std::vector<std::array<float, 2>>& means, means_2d& lanes) {
+	lanes.x.resize(means.size());
+	lanes.y.resize(means.size());
+	for (size_t i = 0; i < means.size(); ++i) {
+		lanes.x[i] = means[i][0];
+		lanes.y[i] = means[i][1];
+	}
+}
+
+/*
+For each of `count` points find the closest mean, storing its index in `labels` and the squared
+distance to it in `distances`. Either output may be null.
+*/
+inline void closest_means_scalar(const std::array<float, 2>* points, size_t count, const means_2d& lanes,
+	uint32_t* labels, float* distances) {
+	assert(lanes.size() > 0);
+	for (size_t p = 0; p < count; ++p) {
+		float best = sum_of_squares(points[p][0] - lanes.x[0], points[p][1] - lanes.y[0]);
+		uint32_t best_index = 0;
+		for (size_t i = 1; i < lanes.size(); ++i) {
+			float d = sum_of_squares(points[p][0] - lanes.x[i], points[p][1] - lanes.y[i]);
+			if (d < best) {
+				best = d;
+				best_index = static_cast<uint32_t>(i);
+			}
+		}
+		if (labels) labels[p] = best_index;
+		if (distances) distances[p] = best;
+	}
+}
+
+#if DKM_HAS_SSE2
+inline __m128 sum_of_squares(__m128 dx, __m128 dy) {
+	__m128 xx = _mm_mul_ps(dx, dx);
+	__m128 yy = _mm_mul_ps(dy, dy);
+	DKM_ROUND(xx);
+	DKM_ROUND(yy);
+	return _mm_add_ps(xx, yy);
+}
+
+inline void closest_means_sse2(const std::array<float, 2>* points, size_t count, const means_2d& lanes,
+	uint32_t* labels, float* distances) {
+	assert(lanes.size() > 0);
+	const float* xy = points[0].data();
+	size_t p = 0;
+	for (; p + 4 <= count; p += 4) {
+		__m128 a = _mm_loadu_ps(xy + 2 * p); // x0 y0 x1 y1
+		__m128 b = _mm_loadu_ps(xy + 2 * p + 4); // x2 y2 x3 y3
+		const __m128 px = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m128 py = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 best = sum_of_squares(_mm_sub_ps(px, _mm_set1_ps(lanes.x[0])), _mm_sub_ps(py, _mm_set1_ps(lanes.y[0])));
+		__m128i best_index = _mm_setzero_si128();
+		for (size_t i = 1; i < lanes.size(); ++i) {
+			__m128 d = sum_of_squares(_mm_sub_ps(px, _mm_set1_ps(lanes.x[i])), _mm_sub_ps(py, _mm_set1_ps(lanes.y[i])));
+			__m128 closer = _mm_cmplt_ps(d, best);
+			__m128i closer_i = _mm_castps_si128(closer);
+			best = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, best));
+			best_index = _mm_or_si128(_mm_and_si128(closer_i, _mm_set1_epi32(static_cast<int32_t>(i))),
+				_mm_andnot_si128(closer_i, best_index));
+		}
+		if (labels) _mm_storeu_si128(reinterpret_cast<__m128i*>(labels + p), best_index);
+		if (distances) _mm_storeu_ps(distances + p, best);
+	}
+	closest_means_scalar(points + p, count - p, lanes,
+		labels ? labels + p : nullptr, distances ? distances + p : nullptr);
+}
+#endif
+
+#if DKM_HAS_AVX2
+__attribute__((target("avx2")))
+inline __m256 sum_of_squares(__m256 dx, __m256 dy) {
+	__m256 xx = _mm256_mul_ps(dx, dx);
+	__m256 yy = _mm256_mul_ps(dy, dy);
+	DKM_ROUND(xx);
+	DKM_ROUND(yy);
+	return _mm256_add_ps(xx, yy);
+}
+
+__attribute__((target("avx2")))
+inline void closest_means_avx2(const std::array<float, 2>* points, size_t count, const means_2d& lanes,
+	uint32_t* labels, float* distances) {
+	assert(lanes.size() > 0);
+	const float* xy = points[0].data();
+	size_t p = 0;
+	for (; p + 8 <= count; p += 8) {
+		__m256 a = _mm256_loadu_ps(xy + 2 * p); // x0 y0 x1 y1 | x2 y2 x3 y3
+		__m256 b = _mm256_loadu_ps(xy + 2 * p + 8); // x4 y4 x5 y5 | x6 y6 x7 y7
+		// shuffling within 128-bit halves leaves pairs of points out of order, so swap them back
+		__m256 x = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)); // x0 x1 x4 x5 | x2 x3 x6 x7
+		__m256 y = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		const __m256 px = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(x), _MM_SHUFFLE(3, 1, 2, 0)));
+		const __m256 py = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(y), _MM_SHUFFLE(3, 1, 2, 0)));
+		__m256 best = sum_of_squares(_mm256_sub_ps(px, _mm256_set1_ps(lanes.x[0])), _mm256_sub_ps(py, _mm256_set1_ps(lanes.y[0])));
+		__m256i best_index = _mm256_setzero_si256();
+		for (size_t i = 1; i < lanes.size(); ++i) {
+			__m256 d = sum_of_squares(_mm256_sub_ps(px, _mm256_set1_ps(lanes.x[i])), _mm256_sub_ps(py, _mm256_set1_ps(lanes.y[i])));
+			__m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+			best = _mm256_blendv_ps(best, d, closer);
+			best_index = _mm256_blendv_epi8(best_index, _mm256_set1_epi32(static_cast<int32_t>(i)), _mm256_castps_si256(closer));
+		}
+		if (labels) _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + p), best_index);
+		if (distances) _mm256_storeu_ps(distances + p, best);
+	}
+	closest_means_scalar(points + p, count - p, lanes,
+		labels ? labels + p : nullptr, distances ? distances + p : nullptr);
+}
+#endif
+
+enum class instruction_set { scalar, sse2, avx2 };
+
+inline instruction_set detect_instruction_set() {
+#if DKM_HAS_AVX2
+	if (__builtin_cpu_supports("avx2")) return instruction_set::avx2;
+#endif
+#if DKM_HAS_SSE2
+	return instruction_set::sse2;
+#else
+	return instruction_set::scalar;
+#endif
+}
+
+inline void closest_means(const std::array<float, 2>* points, size_t count, const means_2d& lanes,
+	uint32_t* labels, float* distances) {
+	static const instruction_set supported = detect_instruction_set();
+	switch (supported) {
+#if DKM_HAS_AVX2
+	case instruction_set::avx2:
+		closest_means_avx2(points, count, lanes, labels, distances);
+		return;
+#endif
+#if DKM_HAS_SSE2
+	case instruction_set::sse2:
+		closest_means_sse2(points, count, lanes, labels, distances);
+		return;
+#endif
+	default:
+		closest_means_scalar(points, count, lanes, labels, distances);
+	}
+}
+
+} // namespace simd
+
 /*
 Calculate the smallest distance between each of the data points and any of the input means.
 */
@@ -64,43 +289,85 @@ std::vector<T> closest_distance(
 }
 
 /*
-This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
-initialization algorithm.
+Lower the distance from each data point to its closest mean to account for a newly added mean.
 */
 template <typename T, size_t N>
-std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed) {
+void update_closest_distance(const std::array<T, N>& mean, const std::vector<std::array<T, N>>& data,
+	std::vector<T>& distances) {
+	assert(distances.size() == data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		T distance = distance_squared(data[i], mean);
+		if (distance < distances[i])
+			distances[i] = distance;
+	}
+}
+
+/*
+kmeans++ initialization that writes into caller-owned buffers and doesn't allocate once they have
+grown to size. Distances to the closest mean are updated as each mean is added rather than
+recalculated. Points are drawn from `Xoshiro256` with the weighted choice made directly on the
+distances, rather than through the standard distributions whose results differ between standard
+libraries, so a seed picks the same means everywhere.
+*/
+template <typename T, size_t N>
+void random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed,
+	std::vector<std::array<T, N>>& means, std::vector<T>& distances) {
 	assert(k > 0);
 	assert(data.size() > 0);
+	assert(data.size() <= UINT32_MAX);
 	using input_size_t = typename std::array<T, N>::size_type;
-	std::vector<std::array<T, N>> means;
-	// Using a very simple PRBS generator, parameters selected according to
-	// https://en.wikipedia.org/wiki/Linear_congruential_generator#Parameters_in_common_use
-	std::linear_congruential_engine<uint64_t, 6364136223846793005, 1442695040888963407, UINT64_MAX> rand_engine(seed);
+	Xoshiro256 rand_engine(seed);
+	const uint32_t count_of_data = static_cast<uint32_t>(data.size());
+	means.clear();
 
 	// Select first mean at random from the set
-	{
-		std::uniform_int_distribution<input_size_t> uniform_generator(0, data.size() - 1);
-		means.push_back(data[uniform_generator(rand_engine)]);
+	means.push_back(data[rand_engine.index(count_of_data)]);
+	distances.resize(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		distances[i] = distance_squared(data[i], means[0]);
 	}
 
 	for (uint32_t count = 1; count < k; ++count) {
-		// Calculate the distance to the closest mean for each data point
-		auto distances = details::closest_distance(means, data);
 		// Pick a random point weighted by the distance from existing means
-		// TODO: This might convert floating point weights to ints, distorting the distribution for small weights
-#if !defined(_MSC_VER) || _MSC_VER >= 1900
-		std::discrete_distribution<input_size_t> generator(distances.begin(), distances.end());
-#else  // MSVC++ older than 14.0
-		input_size_t i = 0;
-		std::discrete_distribution<input_size_t> generator(distances.size(), 0.0, 0.0, [&distances, &i](double) { return distances[i++]; });
-#endif
-		means.push_back(data[generator(rand_engine)]);
+		double total = 0.0;
+		for (T distance : distances) {
+			total += distance;
+		}
+		input_size_t chosen = 0;
+		if (total > 0.0) {
+			double target = rand_engine.uniformDouble() * total;
+			double cumulative = 0.0;
+			for (input_size_t i = 0; i < distances.size(); ++i) {
+				if (distances[i] <= 0) continue;
+				chosen = i;
+				cumulative += distances[i];
+				if (cumulative > target) break;
+			}
+		} else {
+			// every point sits on a mean already
+			chosen = rand_engine.index(count_of_data);
+		}
+		means.push_back(data[chosen]);
+		update_closest_distance(means.back(), data, distances);
 	}
+}
+
+/*
+This is an alternate initialization method based on the [kmeans++](https://en.wikipedia.org/wiki/K-means%2B%2B)
+initialization algorithm.
+*/
+template <typename T, size_t N>
+std::vector<std::array<T, N>> random_plusplus(const std::vector<std::array<T, N>>& data, uint32_t k, uint64_t seed) {
+	std::vector<std::array<T, N>> means;
+	std::vector<T> distances;
+	random_plusplus(data, k, seed, means, distances);
 	return means;
 }
 
 /*
-Calculate the index of the mean a particular data point is closest to (euclidean distance)
+Calculate the index of the mean a particular data point is closest to (euclidean distance). The
+distances are rounded as in `distance_squared`, so for 2-D floats this agrees with the vectorised
+search label for label, ties included.
 */
 template <typename T, size_t N>
 uint32_t closest_mean(const std::array<T, N>& point, const std::vector<std::array<T, N>>& means) {
@@ -125,12 +392,68 @@ template <typename T, size_t N>
 std::vector<uint32_t> calculate_clusters(
 	const std::vector<std::array<T, N>>& data, const std::vector<std::array<T, N>>& means) {
 	std::vector<uint32_t> clusters;
+	clusters.reserve(data.size());
 	for (auto& point : data) {
 		clusters.push_back(closest_mean(point, means));
 	}
 	return clusters;
 }
 
+inline std::vector<uint32_t> calculate_clusters(
+	const std::vector<std::array<float, 2>>& data, const std::vector<std::array<float, 2>>& means) {
+	assert(!means.empty());
+	simd::means_2d lanes;
+	simd::transpose_means(means, lanes);
+	std::vector<uint32_t> clusters(data.size());
+	simd::closest_means(data.data(), data.size(), lanes, clusters.data(), nullptr);
+	return clusters;
+}
+
+/*
+Reassign each data point to its closest mean in place, returning whether any assignment changed.
+`lanes` is scratch space for the vectorised 2-D float overload and is unused otherwise.
+*/
+template <typename T, size_t N>
+bool update_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	simd::means_2d&) {
+	assert(clusters.size() == data.size());
+	bool changed = false;
+	for (size_t i = 0; i < data.size(); ++i) {
+		uint32_t cluster = closest_mean(data[i], means);
+		if (cluster != clusters[i]) {
+			clusters[i] = cluster;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+inline bool update_clusters(const std::vector<std::array<float, 2>>& data,
+	const std::vector<std::array<float, 2>>& means,
+	std::vector<uint32_t>& clusters,
+	simd::means_2d& lanes) {
+	assert(clusters.size() == data.size());
+	assert(!means.empty());
+	simd::transpose_means(means, lanes);
+	// work in blocks so the new labels can be compared with the old ones while still in cache
+	constexpr size_t block_size = 256;
+	uint32_t block[block_size];
+	bool changed = false;
+	for (size_t begin = 0; begin < data.size(); begin += block_size) {
+		size_t count = std::min(block_size, data.size() - begin);
+		simd::closest_means(data.data() + begin, count, lanes, block, nullptr);
+		for (size_t i = 0; i < count; ++i) {
+			if (block[i] != clusters[begin + i]) {
+				clusters[begin + i] = block[i];
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
 /*
 Calculate means based on data points and their cluster assignments.
 */
@@ -160,6 +483,39 @@ std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>
 	return means;
 }
 
+/*
+As `calculate_means`, writing into `means` and using `sums` and `count` as scratch space so that
+nothing is allocated once the buffers have grown to size.
+*/
+template <typename T, size_t N>
+void calculate_means(const std::vector<std::array<T, N>>& data,
+	const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& old_means,
+	uint32_t k,
+	std::vector<std::array<T, N>>& means,
+	std::vector<std::array<T, N>>& sums,
+	std::vector<T>& count) {
+	sums.assign(k, std::array<T, N>());
+	count.assign(k, T());
+	for (size_t i = 0; i < std::min(clusters.size(), data.size()); ++i) {
+		auto& sum = sums[clusters[i]];
+		count[clusters[i]] += 1;
+		for (size_t j = 0; j < N; ++j) {
+			sum[j] += data[i][j];
+		}
+	}
+	means.resize(k);
+	for (size_t i = 0; i < k; ++i) {
+		if (count[i] == 0) {
+			means[i] = old_means[i];
+		} else {
+			for (size_t j = 0; j < N; ++j) {
+				means[i][j] = sums[i][j] / count[i];
+			}
+		}
+	}
+}
+
 template <typename T, size_t N>
 std::vector<T> deltas(
 	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means)
@@ -183,6 +539,173 @@ bool deltas_below_limit(const std::vector<T>& deltas, T min_delta) {
 	return true;
 }
 
+template <typename T, size_t N>
+bool means_moved_below_limit(
+	const std::vector<std::array<T, N>>& old_means, const std::vector<std::array<T, N>>& means, T min_delta) {
+	assert(old_means.size() == means.size());
+	for (size_t i = 0; i < means.size(); ++i) {
+		if (distance(means[i], old_means[i]) > min_delta) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+Per-point distance bounds for [Hamerly's algorithm](https://doi.org/10.1137/1.9781611972801.12),
+which uses the triangle inequality to skip most distance calculations once points stop changing
+cluster. `upper` bounds the distance from each point to its assigned mean and `lower` bounds the
+distance to every other mean. The bounds refer to `bound_means` and are moved along with the means
+before each use. A point with an infinite upper bound has its distances recalculated.
+*/
+template <typename T, size_t N>
+struct hamerly_bounds {
+	std::vector<double> upper;
+	std::vector<double> lower;
+	std::vector<std::array<T, N>> bound_means;
+	// scratch space
+	std::vector<double> drift;
+	std::vector<double> half_separation;
+
+	size_t size() const { return upper.size(); }
+
+	void reset(size_t size, const std::vector<std::array<T, N>>& means) {
+		upper.assign(size, std::numeric_limits<double>::infinity());
+		lower.assign(size, 0.0);
+		bound_means = means;
+	}
+
+	void clear() {
+		upper.clear();
+		lower.clear();
+	}
+
+	void add() {
+		upper.push_back(std::numeric_limits<double>::infinity());
+		lower.push_back(0.0);
+	}
+
+	void invalidate(size_t index) {
+		upper[index] = std::numeric_limits<double>::infinity();
+		lower[index] = 0.0;
+	}
+
+	void erase(size_t index) {
+		upper.erase(upper.begin() + index);
+		lower.erase(lower.begin() + index);
+	}
+};
+
+/*
+Relative slack applied when a bound is used to skip a point. Assignment compares squared distances
+in T, so bounds that are only just tight enough to decide between two means are not trusted: those
+points get their distances recalculated, which keeps the labels identical to `calculate_clusters`.
+*/
+template <typename T>
+constexpr double hamerly_margin() {
+	return 64.0 * (std::is_floating_point<T>::value ? std::numeric_limits<T>::epsilon() : std::numeric_limits<double>::epsilon());
+}
+
+template <typename T>
+bool hamerly_bound_holds(double upper, double limit) {
+	return upper + hamerly_margin<T>() * (upper + limit) < limit;
+}
+
+/*
+As `update_clusters`, skipping the points whose bounds show they can't have changed cluster.
+Returns whether any assignment changed.
+*/
+template <typename T, size_t N>
+bool hamerly_update_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	hamerly_bounds<T, N>& bounds,
+	kmeans_statistics* statistics) {
+	assert(clusters.size() == data.size());
+	assert(bounds.size() == data.size());
+	assert(!means.empty());
+	const size_t k = means.size();
+	uint64_t point_evaluations = 0;
+	uint64_t mean_evaluations = 0;
+
+	// Move the bounds by how far each mean has moved since they were last updated
+	bounds.drift.resize(k);
+	double largest_drift = 0.0;
+	double second_largest_drift = 0.0;
+	uint32_t largest_drift_index = 0;
+	for (size_t c = 0; c < k; ++c) {
+		bounds.drift[c] = distance(to_double(bounds.bound_means[c]), to_double(means[c]));
+		++mean_evaluations;
+		if (bounds.drift[c] > largest_drift) {
+			second_largest_drift = largest_drift;
+			largest_drift = bounds.drift[c];
+			largest_drift_index = static_cast<uint32_t>(c);
+		} else if (bounds.drift[c] > second_largest_drift) {
+			second_largest_drift = bounds.drift[c];
+		}
+	}
+	for (size_t i = 0; i < data.size(); ++i) {
+		bounds.upper[i] += bounds.drift[clusters[i]];
+		bounds.lower[i] -= (clusters[i] == largest_drift_index) ? second_largest_drift : largest_drift;
+	}
+	bounds.bound_means = means;
+
+	// A point closer to its mean than half the distance from that mean to any other can't move
+	bounds.half_separation.assign(k, std::numeric_limits<double>::infinity());
+	for (size_t a = 0; a < k; ++a) {
+		for (size_t b = a + 1; b < k; ++b) {
+			double half = 0.5 * distance(to_double(means[a]), to_double(means[b]));
+			++mean_evaluations;
+			bounds.half_separation[a] = std::min(bounds.half_separation[a], half);
+			bounds.half_separation[b] = std::min(bounds.half_separation[b], half);
+		}
+	}
+
+	bool changed = false;
+	for (size_t i = 0; i < data.size(); ++i) {
+		uint32_t cluster = clusters[i];
+		double limit = std::max(bounds.half_separation[cluster], bounds.lower[i]);
+		if (hamerly_bound_holds<T>(bounds.upper[i], limit)) continue;
+
+		// tighten the upper bound and try again
+		bounds.upper[i] = std::sqrt(static_cast<double>(distance_squared(data[i], means[cluster])));
+		++point_evaluations;
+		if (hamerly_bound_holds<T>(bounds.upper[i], limit)) continue;
+
+		// compare against every mean, exactly as closest_mean does
+		T closest = distance_squared(data[i], means[0]);
+		T second_closest = std::numeric_limits<T>::max();
+		uint32_t index = 0;
+		for (size_t c = 1; c < k; ++c) {
+			T d = distance_squared(data[i], means[c]);
+			if (d < closest) {
+				second_closest = closest;
+				closest = d;
+				index = static_cast<uint32_t>(c);
+			} else if (d < second_closest) {
+				second_closest = d;
+			}
+		}
+		point_evaluations += k;
+		bounds.upper[i] = std::sqrt(static_cast<double>(closest));
+		bounds.lower[i] = (k > 1) ? std::sqrt(static_cast<double>(second_closest)) : std::numeric_limits<double>::infinity();
+		if (index != cluster) {
+			clusters[i] = index;
+			changed = true;
+		}
+	}
+
+	if (statistics) {
+		uint64_t lloyd_evaluations = static_cast<uint64_t>(data.size()) * k;
+		statistics->lloyd_distance_evaluations += lloyd_evaluations;
+		statistics->distance_evaluations += point_evaluations + mean_evaluations;
+		if (lloyd_evaluations > point_evaluations) {
+			statistics->distance_evaluations_skipped += lloyd_evaluations - point_evaluations;
+		}
+	}
+	return changed;
+}
+
 } // namespace details
 
 /*
@@ -296,6 +819,421 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
 	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
 }
 
+/*
+kmeans_workspace holds every buffer used by a run of `kmeans_lloyd`, so that repeated runs over data
+of a similar size reuse memory instead of allocating. The results of a run are left in `means` and
+`clusters`.
+*/
+template <typename T, size_t N>
+struct kmeans_workspace {
+	std::vector<std::array<T, N>> means;
+	std::vector<uint32_t> clusters;
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<std::array<T, N>> sums;
+	std::vector<T> counts;
+	std::vector<T> distances;
+	details::simd::means_2d lanes;
+};
+
+/*
+Version of `kmeans_lloyd` that writes its results into `workspace.means` and `workspace.clusters`
+and performs no heap allocations once the workspace buffers have grown to fit the data. The previous
+means are swapped rather than copied between iterations. Returns the number of iterations run.
+
+kmeans++ initialization uses the allocation-free overload of `details::random_plusplus`, which
+draws the same Xoshiro256 sequence, so the result is identical to `kmeans_lloyd` with the same
+parameters.
+*/
+template <typename T, size_t N>
+uint64_t kmeans_lloyd(const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_workspace<T, N>& workspace) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_lloyd requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	uint64_t seed = parameters.has_random_seed() ? parameters.get_random_seed() : std::random_device()();
+	details::random_plusplus(data, parameters.get_k(), seed, workspace.means, workspace.distances);
+
+	workspace.old_means.clear();
+	workspace.old_old_means.clear();
+	workspace.clusters.resize(data.size());
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	uint64_t count = 0;
+	do {
+		details::update_clusters(data, workspace.means, workspace.clusters, workspace.lanes);
+		std::swap(workspace.old_old_means, workspace.old_means);
+		std::swap(workspace.old_means, workspace.means);
+		details::calculate_means(data, workspace.clusters, workspace.old_means, parameters.get_k(),
+			workspace.means, workspace.sums, workspace.counts);
+		++count;
+	} while (workspace.means != workspace.old_means && workspace.means != workspace.old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::means_moved_below_limit(workspace.old_means, workspace.means, parameters.get_min_delta())));
+
+	return count;
+}
+
+/*
+Version of `kmeans_lloyd` that uses Hamerly's bounds to skip distance calculations for points that
+can't have changed cluster. Seeding, the means calculation and the convergence tests are the same
+as `kmeans_lloyd`, and the result is identical to `kmeans_lloyd` with the same parameters.
+
+If `statistics` is given, the iteration and distance counts of this run are added to it.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_hamerly(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters,
+	kmeans_statistics* statistics = nullptr) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_hamerly requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	std::random_device rand_device;
+	uint64_t seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means = details::random_plusplus(data, parameters.get_k(), seed);
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters(data.size());
+	details::hamerly_bounds<T, N> bounds;
+	bounds.reset(data.size(), means);
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	uint64_t count = 0;
+	do {
+		details::hamerly_update_clusters(data, means, clusters, bounds, statistics);
+		old_old_means = old_means;
+		old_means = means;
+		means = details::calculate_means(data, clusters, old_means, parameters.get_k());
+		++count;
+	} while (means != old_means && means != old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	if (statistics) statistics->iterations += count;
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+class thread_pool;
+
+template <typename T, size_t N>
+class kmeans_state;
+
+// Defined in dkm_parallel.hpp
+template <typename T, size_t N>
+uint64_t refine_parallel(kmeans_state<T, N>& state, const std::vector<std::array<T, N>>& data, uint64_t max_iter, thread_pool& pool);
+
+/*
+kmeans_state keeps a k-means solution alive across small changes to the data set, for callers that
+add and evict a few points at a time and want to avoid re-clustering from scratch.
+
+The caller owns the data. The state tracks the means, the cluster assignment of each data point
+and per-cluster running sums, and expects to be told about every change to the data:
+* `seed` runs kmeans++ over the current data and assigns every point. Until the state is seeded
+  `add_point` and `evict_point` do nothing.
+* `add_point` must be called after a point is appended to the data. The point is assigned to its
+  closest mean and that mean is updated from the running sums.
+* `evict_point` must be called before the point at `index` is removed from the data.
+* `replace_point` must be called after the point at `index` is overwritten in place, e.g. when the
+  data is a ring buffer. Unlike `evict_point` this leaves the indices of the other points unchanged.
+* `refine` runs at most `max_iter` Lloyd iterations starting from the current means (a warm start),
+  stopping early once no assignment changes. It returns the number of iterations run.
+* `refine_accelerated` gives the same result as `refine` using Hamerly's bounds, which are kept
+  between calls so that points that stay put from frame to frame are cheap. Calling `refine` or
+  `refine_parallel` discards the bounds.
+
+Because the means are carried over between calls, cluster identities stay stable from one refinement
+to the next without having to fix the random seed.
+*/
+template <typename T, size_t N>
+class kmeans_state {
+public:
+	explicit kmeans_state(const clustering_parameters<T>& parameters) :
+	_parameters(parameters)
+	{}
+
+	bool is_seeded() const { return !_means.empty(); }
+	uint32_t get_k() const { return _parameters.get_k(); }
+	const std::vector<std::array<T, N>>& means() const { return _means; }
+	const std::vector<uint32_t>& clusters() const { return _clusters; }
+	const std::vector<size_t>& counts() const { return _counts; } // points in each cluster, in step with clusters()
+
+	void seed(const std::vector<std::array<T, N>>& data) {
+		static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+			"kmeans_state requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+		assert(get_k() > 0); // k must be greater than zero
+		assert(data.size() >= get_k()); // there must be at least k data points
+		std::random_device rand_device;
+		uint64_t seed = _parameters.has_random_seed() ? _parameters.get_random_seed() : rand_device();
+		_means = details::random_plusplus(data, get_k(), seed);
+		_clusters = details::calculate_clusters(data, _means);
+		update_sums(data);
+		_bounds.clear();
+	}
+
+	void add_point(const std::array<T, N>& point) {
+		if (!is_seeded()) return;
+		uint32_t cluster = details::closest_mean(point, _means);
+		_clusters.push_back(cluster);
+		add_to_sums(point, cluster);
+		update_mean(cluster);
+		if (has_bounds(_clusters.size() - 1)) _bounds.add();
+	}
+
+	void evict_point(const std::array<T, N>& point, size_t index) {
+		if (!is_seeded()) return;
+		assert(index < _clusters.size());
+		uint32_t cluster = _clusters[index];
+		remove_from_sums(point, cluster);
+		update_mean(cluster);
+		if (has_bounds()) _bounds.erase(index);
+		_clusters.erase(_clusters.begin() + index);
+	}
+
+	void replace_point(size_t index, const std::array<T, N>& old_point, const std::array<T, N>& new_point) {
+		if (!is_seeded()) return;
+		assert(index < _clusters.size());
+		uint32_t old_cluster = _clusters[index];
+		remove_from_sums(old_point, old_cluster);
+		update_mean(old_cluster);
+		uint32_t cluster = details::closest_mean(new_point, _means);
+		_clusters[index] = cluster;
+		add_to_sums(new_point, cluster);
+		update_mean(cluster);
+		if (has_bounds()) _bounds.invalidate(index);
+	}
+
+	uint64_t refine(const std::vector<std::array<T, N>>& data, uint64_t max_iter) {
+		assert(is_seeded());
+		assert(data.size() == _clusters.size());
+		_bounds.clear();
+		uint64_t count = 0;
+		while (count < max_iter) {
+			bool changed = details::update_clusters(data, _means, _clusters, _lanes);
+			++count;
+			if (!changed) break;
+			update_sums(data);
+		}
+		return count;
+	}
+
+	uint64_t refine_accelerated(const std::vector<std::array<T, N>>& data, uint64_t max_iter, kmeans_statistics* statistics = nullptr) {
+		assert(is_seeded());
+		assert(data.size() == _clusters.size());
+		if (!has_bounds()) _bounds.reset(_clusters.size(), _means);
+		uint64_t count = 0;
+		while (count < max_iter) {
+			bool changed = details::hamerly_update_clusters(data, _means, _clusters, _bounds, statistics);
+			++count;
+			if (!changed) break;
+			update_sums(data);
+		}
+		if (statistics) statistics->iterations += count;
+		return count;
+	}
+
+private:
+	friend uint64_t refine_parallel<T, N>(kmeans_state<T, N>& state, const std::vector<std::array<T, N>>& data, uint64_t max_iter, thread_pool& pool);
+
+	// bounds are only maintained while refine_accelerated is in use
+	bool has_bounds(size_t point_count) const { return point_count > 0 && _bounds.size() == point_count; }
+	bool has_bounds() const { return has_bounds(_clusters.size()); }
+
+	void update_sums(const std::vector<std::array<T, N>>& data) {
+		_sums.assign(get_k(), std::array<T, N>());
+		_counts.assign(get_k(), 0);
+		for (size_t i = 0; i < data.size(); ++i) {
+			add_to_sums(data[i], _clusters[i]);
+		}
+		for (uint32_t i = 0; i < get_k(); ++i) {
+			update_mean(i);
+		}
+	}
+
+	void add_to_sums(const std::array<T, N>& point, uint32_t cluster) {
+		auto& sum = _sums[cluster];
+		for (size_t j = 0; j < N; ++j) {
+			sum[j] += point[j];
+		}
+		++_counts[cluster];
+	}
+
+	void remove_from_sums(const std::array<T, N>& point, uint32_t cluster) {
+		auto& sum = _sums[cluster];
+		for (size_t j = 0; j < N; ++j) {
+			sum[j] -= point[j];
+		}
+		--_counts[cluster];
+	}
+
+	// an empty cluster keeps its previous mean, as in calculate_means
+	void update_mean(uint32_t cluster) {
+		if (_counts[cluster] == 0) return;
+		for (size_t j = 0; j < N; ++j) {
+			_means[cluster][j] = _sums[cluster][j] / static_cast<T>(_counts[cluster]);
+		}
+	}
+
+	clustering_parameters<T> _parameters;
+	std::vector<std::array<T, N>> _means;
+	std::vector<std::array<T, N>> _sums;
+	std::vector<size_t> _counts;
+	std::vector<uint32_t> _clusters;
+	details::hamerly_bounds<T, N> _bounds;
+	// scratch space, kept so that steady-state refinement doesn't allocate
+	details::simd::means_2d _lanes;
+	std::vector<std::array<T, N>> _block_sums;
+	std::vector<size_t> _block_counts;
+};
+
+/*
+minibatch_parameters is the configuration used for `kmeans_minibatch_state`.
+
+Like `clustering_parameters` it requires a k value, and can additionally be configured with:
+* Batch size; the number of data points sampled by each call to `step`.
+* Minimum learning rate; each mean moves towards the points assigned to it at a rate of
+  1 / (number of points it has been assigned so far), as in Sculley's mini-batch k-means. Left
+  alone that rate tends to zero and the means freeze. A minimum rate keeps them following data
+  that changes over time.
+* Random seed; if present, this will be used in place of `std::random_device` for kmeans++
+  initialization and batch sampling.
+*/
+template <typename T>
+class minibatch_parameters {
+public:
+	explicit minibatch_parameters(uint32_t k) :
+	_k(k),
+	_batch_size(256),
+	_min_learning_rate(),
+	_has_rand_seed(false), _rand_seed()
+	{}
+
+	void set_batch_size(size_t batch_size)
+	{
+		assert(batch_size > 0);
+		_batch_size = batch_size;
+	}
+
+	void set_min_learning_rate(T min_learning_rate)
+	{
+		_min_learning_rate = min_learning_rate;
+	}
+
+	void set_random_seed(uint64_t rand_seed)
+	{
+		_rand_seed = rand_seed;
+		_has_rand_seed = true;
+	}
+
+	bool has_random_seed() const { return _has_rand_seed; }
+
+	uint32_t get_k() const { return _k; };
+	size_t get_batch_size() const { return _batch_size; }
+	T get_min_learning_rate() const { return _min_learning_rate; }
+	uint64_t get_random_seed() const { return _rand_seed; }
+
+private:
+	uint32_t _k;
+	size_t _batch_size;
+	T _min_learning_rate;
+	bool _has_rand_seed;
+	uint64_t _rand_seed;
+};
+
+/*
+kmeans_minibatch_state clusters data sets that are too large to iterate over every frame, using
+[mini-batch k-means](https://www.eecs.tufts.edu/~dsculley/papers/fastkmeans.pdf). Each `step`
+samples a fixed-size batch of points, assigns them to the current means and moves those means
+towards them, so the cost of a step doesn't depend on the size of the data.
+
+The caller owns the data and may change it freely between steps. Cluster labels aren't kept for
+the whole data set: `label` works out the cluster for a single point on demand and caches it until
+the means next change, so only the points that are actually looked at are ever assigned.
+*/
+template <typename T, size_t N>
+class kmeans_minibatch_state {
+public:
+	explicit kmeans_minibatch_state(const minibatch_parameters<T>& parameters) :
+	_parameters(parameters),
+	_rand_engine(parameters.has_random_seed() ? parameters.get_random_seed() : std::random_device()())
+	{}
+
+	bool is_seeded() const { return !_means.empty(); }
+	uint32_t get_k() const { return _parameters.get_k(); }
+	const minibatch_parameters<T>& get_parameters() const { return _parameters; }
+	const std::vector<std::array<T, N>>& means() const { return _means; }
+	// points of the last step's batch assigned to each cluster, a sample of how the data divides up
+	const std::vector<size_t>& batch_counts() const { return _batch_counts; }
+
+	void seed(const std::vector<std::array<T, N>>& data) {
+		static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+			"kmeans_minibatch_state requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+		assert(get_k() > 0); // k must be greater than zero
+		assert(data.size() >= get_k()); // there must be at least k data points
+		details::random_plusplus(data, get_k(), _rand_engine(), _means, _distances);
+		_assigned_counts.assign(get_k(), 0);
+		_batch_counts.assign(get_k(), 0);
+		++_generation;
+	}
+
+	void step(const std::vector<std::array<T, N>>& data) {
+		assert(is_seeded());
+		assert(!data.empty());
+		assert(data.size() <= UINT32_MAX);
+		_batch.resize(_parameters.get_batch_size());
+		for (auto& point : _batch) {
+			point = data[_rand_engine.index(static_cast<uint32_t>(data.size()))];
+		}
+		// assign the whole batch against the same means before moving any of them
+		_batch_clusters.resize(_batch.size());
+		details::update_clusters(_batch, _means, _batch_clusters, _lanes);
+		std::fill(_batch_counts.begin(), _batch_counts.end(), 0);
+		for (size_t i = 0; i < _batch.size(); ++i) {
+			uint32_t cluster = _batch_clusters[i];
+			++_batch_counts[cluster];
+			T rate = std::max(T(1) / static_cast<T>(++_assigned_counts[cluster]), _parameters.get_min_learning_rate());
+			auto& mean = _means[cluster];
+			for (size_t j = 0; j < N; ++j) {
+				mean[j] += rate * (_batch[i][j] - mean[j]);
+			}
+		}
+		++_generation;
+	}
+
+	uint32_t label(const std::vector<std::array<T, N>>& data, size_t index) {
+		assert(is_seeded());
+		assert(index < data.size());
+		if (_labels.size() < data.size()) {
+			_labels.resize(data.size());
+			_label_generations.resize(data.size(), 0);
+		}
+		if (_label_generations[index] != _generation) {
+			_labels[index] = details::closest_mean(data[index], _means);
+			_label_generations[index] = _generation;
+		}
+		return _labels[index];
+	}
+
+private:
+	using rand_engine_t = Xoshiro256;
+
+	minibatch_parameters<T> _parameters;
+	rand_engine_t _rand_engine;
+	std::vector<std::array<T, N>> _means;
+	std::vector<uint64_t> _assigned_counts;
+	std::vector<size_t> _batch_counts;
+	// labels are valid only while their generation matches, and the generation moves on with the means
+	uint64_t _generation = 1;
+	std::vector<uint32_t> _labels;
+	std::vector<uint64_t> _label_generations;
+	// scratch space
+	std::vector<std::array<T, N>> _batch;
+	std::vector<uint32_t> _batch_clusters;
+	std::vector<T> _distances;
+	details::simd::means_2d _lanes;
+};
+
 /*
 This overload exists to support legacy code which uses this signature of the kmeans_lloyd function.
 Any code still using this signature should move to the version of this function that uses a
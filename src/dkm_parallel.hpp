@@ -0,0 +1,312 @@
+#pragma once
+
+#ifndef DKM_PARALLEL_KMEANS_H
+#define DKM_PARALLEL_KMEANS_H
+
+#include "dkm.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+DKM - Parallel variants of the k-means algorithms in dkm.hpp, running on a persistent thread pool.
+*/
+namespace dkm {
+
+/*
+thread_pool is a fixed set of worker threads that are started once and reused for every parallel
+call, so clustering doesn't pay for thread creation each frame.
+
+`parallel_for(count, f)` calls `f(i)` for every i in [0, count) and returns once all calls have
+finished. The calling thread works alongside the pool, so a pool with a thread count of 1 runs
+everything on the caller.
+*/
+class thread_pool {
+public:
+	explicit thread_pool(size_t thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+		start(thread_count);
+	}
+
+	~thread_pool() {
+		stop();
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	// Total number of threads used by parallel_for, including the caller
+	size_t get_thread_count() const { return _workers.size() + 1; }
+
+	void set_thread_count(size_t thread_count) {
+		if (thread_count == get_thread_count()) return;
+		stop();
+		start(thread_count);
+	}
+
+	template <typename F>
+	void parallel_for(size_t count, F&& f) {
+		if (count == 0) return;
+		if (_workers.empty() || count == 1) {
+			for (size_t i = 0; i < count; ++i) f(i);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_task = std::ref(f);
+			_task_count = count;
+			_next_index = 0;
+			_busy_workers = _workers.size();
+			++_generation;
+		}
+		_start_condition.notify_all();
+		run_tasks();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done_condition.wait(lock, [this] { return _busy_workers == 0; });
+		_task = nullptr;
+	}
+
+private:
+	void start(size_t thread_count) {
+		assert(thread_count > 0);
+		_stopping = false;
+		for (size_t i = 1; i < thread_count; ++i) {
+			_workers.emplace_back([this, generation = _generation] { work(generation); });
+		}
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_start_condition.notify_all();
+		for (auto& worker : _workers) {
+			worker.join();
+		}
+		_workers.clear();
+	}
+
+	void run_tasks() {
+		for (size_t i = _next_index++; i < _task_count; i = _next_index++) {
+			_task(i);
+		}
+	}
+
+	void work(uint64_t seen_generation) {
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start_condition.wait(lock, [this, seen_generation] { return _stopping || _generation != seen_generation; });
+				if (_stopping) return;
+				seen_generation = _generation;
+			}
+			run_tasks();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				--_busy_workers;
+			}
+			_done_condition.notify_one();
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _start_condition;
+	std::condition_variable _done_condition;
+	std::function<void(size_t)> _task;
+	size_t _task_count = 0;
+	std::atomic<size_t> _next_index { 0 };
+	size_t _busy_workers = 0;
+	uint64_t _generation = 0;
+	bool _stopping = false;
+};
+
+namespace details {
+
+/*
+Data is split into blocks of a fixed size, independent of the number of threads. Each block
+produces its own partial sums, and the partials are then added together in block order, so the
+means come out the same whatever the thread count.
+*/
+constexpr size_t parallel_block_size = 1024;
+
+inline size_t parallel_block_count(size_t data_size) {
+	return (data_size + parallel_block_size - 1) / parallel_block_size;
+}
+
+template <typename T, size_t N>
+bool parallel_update_clusters(const std::vector<std::array<T, N>>& data,
+	const std::vector<std::array<T, N>>& means,
+	std::vector<uint32_t>& clusters,
+	simd::means_2d&,
+	thread_pool& pool) {
+	assert(clusters.size() == data.size());
+	std::atomic<bool> changed { false };
+	pool.parallel_for(parallel_block_count(data.size()), [&](size_t block) {
+		size_t begin = block * parallel_block_size;
+		size_t end = std::min(data.size(), begin + parallel_block_size);
+		bool block_changed = false;
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t cluster = closest_mean(data[i], means);
+			if (cluster != clusters[i]) {
+				clusters[i] = cluster;
+				block_changed = true;
+			}
+		}
+		if (block_changed) changed = true;
+	});
+	return changed;
+}
+
+inline bool parallel_update_clusters(const std::vector<std::array<float, 2>>& data,
+	const std::vector<std::array<float, 2>>& means,
+	std::vector<uint32_t>& clusters,
+	simd::means_2d& lanes,
+	thread_pool& pool) {
+	assert(clusters.size() == data.size());
+	assert(!means.empty());
+	simd::transpose_means(means, lanes);
+	std::atomic<bool> changed { false };
+	pool.parallel_for(parallel_block_count(data.size()), [&](size_t block) {
+		size_t begin = block * parallel_block_size;
+		size_t count = std::min(parallel_block_size, data.size() - begin);
+		uint32_t labels[parallel_block_size];
+		simd::closest_means(data.data() + begin, count, lanes, labels, nullptr);
+		bool block_changed = false;
+		for (size_t i = 0; i < count; ++i) {
+			if (labels[i] != clusters[begin + i]) {
+				clusters[begin + i] = labels[i];
+				block_changed = true;
+			}
+		}
+		if (block_changed) changed = true;
+	});
+	return changed;
+}
+
+/*
+Per-cluster sums and counts of the data, computed in parallel blocks and reduced in block order.
+`block_sums` and `block_counts` are scratch space, resized as needed.
+*/
+template <typename T, size_t N>
+void parallel_sums(const std::vector<std::array<T, N>>& data,
+	const std::vector<uint32_t>& clusters,
+	uint32_t k,
+	std::vector<std::array<T, N>>& block_sums,
+	std::vector<size_t>& block_counts,
+	std::vector<std::array<T, N>>& sums,
+	std::vector<size_t>& counts,
+	thread_pool& pool) {
+	size_t block_count = parallel_block_count(data.size());
+	block_sums.assign(block_count * k, std::array<T, N>());
+	block_counts.assign(block_count * k, 0);
+	pool.parallel_for(block_count, [&](size_t block) {
+		size_t begin = block * parallel_block_size;
+		size_t end = std::min(data.size(), begin + parallel_block_size);
+		std::array<T, N>* block_sum = &block_sums[block * k];
+		size_t* block_count = &block_counts[block * k];
+		for (size_t i = begin; i < end; ++i) {
+			auto& sum = block_sum[clusters[i]];
+			for (size_t j = 0; j < N; ++j) {
+				sum[j] += data[i][j];
+			}
+			++block_count[clusters[i]];
+		}
+	});
+	sums.assign(k, std::array<T, N>());
+	counts.assign(k, 0);
+	for (size_t block = 0; block < block_count; ++block) {
+		for (uint32_t c = 0; c < k; ++c) {
+			for (size_t j = 0; j < N; ++j) {
+				sums[c][j] += block_sums[block * k + c][j];
+			}
+			counts[c] += block_counts[block * k + c];
+		}
+	}
+}
+
+/*
+Means from per-cluster sums and counts. An empty cluster keeps its old mean.
+*/
+template <typename T, size_t N>
+void means_from_sums(const std::vector<std::array<T, N>>& sums,
+	const std::vector<size_t>& counts,
+	std::vector<std::array<T, N>>& means) {
+	for (size_t c = 0; c < sums.size(); ++c) {
+		if (counts[c] == 0) continue;
+		for (size_t j = 0; j < N; ++j) {
+			means[c][j] = sums[c][j] / static_cast<T>(counts[c]);
+		}
+	}
+}
+
+} // namespace details
+
+/*
+Parallel version of `kmeans_lloyd`, with the assignment and mean update steps split across the
+threads of `pool`. kmeans++ initialization and the convergence tests are the same as in
+`kmeans_lloyd`.
+
+Sums are reduced in a fixed block order, so the result is identical for any thread count. It can
+differ from `kmeans_lloyd` in the last bits of the means because the additions are grouped
+differently.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd_parallel(
+	const std::vector<std::array<T, N>>& data, const clustering_parameters<T>& parameters, thread_pool& pool) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_lloyd_parallel requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(parameters.get_k() > 0); // k must be greater than zero
+	assert(data.size() >= parameters.get_k()); // there must be at least k data points
+	std::random_device rand_device;
+	uint64_t seed = parameters.has_random_seed() ? parameters.get_random_seed() : rand_device();
+	std::vector<std::array<T, N>> means = details::random_plusplus(data, parameters.get_k(), seed);
+
+	std::vector<std::array<T, N>> old_means;
+	std::vector<std::array<T, N>> old_old_means;
+	std::vector<uint32_t> clusters(data.size());
+	std::vector<std::array<T, N>> block_sums, sums;
+	std::vector<size_t> block_counts, counts;
+	details::simd::means_2d lanes;
+	// Calculate new means until convergence is reached or we hit the maximum iteration count
+	uint64_t count = 0;
+	do {
+		details::parallel_update_clusters(data, means, clusters, lanes, pool);
+		old_old_means = old_means;
+		old_means = means;
+		details::parallel_sums(data, clusters, parameters.get_k(), block_sums, block_counts, sums, counts, pool);
+		details::means_from_sums(sums, counts, means);
+		++count;
+	} while (means != old_means && means != old_old_means
+		&& !(parameters.has_max_iteration() && count == parameters.get_max_iteration())
+		&& !(parameters.has_min_delta() && details::deltas_below_limit(details::deltas(old_means, means), parameters.get_min_delta())));
+
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+/*
+Parallel version of `kmeans_state::refine`, with the same block-ordered reduction as
+`kmeans_lloyd_parallel`.
+*/
+template <typename T, size_t N>
+uint64_t refine_parallel(kmeans_state<T, N>& state, const std::vector<std::array<T, N>>& data, uint64_t max_iter, thread_pool& pool) {
+	assert(state.is_seeded());
+	assert(data.size() == state._clusters.size());
+	state._bounds.clear();
+	uint64_t count = 0;
+	while (count < max_iter) {
+		bool changed = details::parallel_update_clusters(data, state._means, state._clusters, state._lanes, pool);
+		++count;
+		if (!changed) break;
+		details::parallel_sums(data, state._clusters, state.get_k(), state._block_sums, state._block_counts, state._sums, state._counts, pool);
+		details::means_from_sums(state._sums, state._counts, state._means);
+	}
+	return count;
+}
+
+} // namespace dkm
+
+#endif /* DKM_PARALLEL_KMEANS_H */
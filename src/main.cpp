@@ -1,9 +1,48 @@
 #include "ofMain.h"
 #include "ofApp.h"
 #include "Constants.h"
+#include "BatchSettings.h"
+#include "OscsReader.h"
+#include "MappedAnalysisRecording.h"
+#include "FluidBenchmark.h"
 
 //========================================================================
-int main( ){
+int main(int argc, char* argv[]){
+
+	BatchSettings batchSettings;
+	if (!parseBatchSettings(argc, argv, batchSettings)) return 1;
+
+	if (batchSettings.fluidBenchmark) {
+		benchmarkFluid(std::cout);
+		return 0;
+	}
+
+	if (batchSettings.isConversion()) {
+		OscsReader session;
+		if (!session.load(batchSettings.convertInputPath)) {
+			ofLogError() << "convert: can't read " << batchSettings.convertInputPath;
+			return 1;
+		}
+		if (!MappedAnalysisRecording::write(session, batchSettings.convertOutputPath)) {
+			ofLogError() << "convert: can't write " << batchSettings.convertOutputPath;
+			return 1;
+		}
+		ofLogNotice() << "convert: " << session.size() << " frames of " << session.getScalarCount() << " values, "
+		              << session.getDuration() << "s, written to " << batchSettings.convertOutputPath;
+		return 0;
+	}
+
+	if (batchSettings.isEnabled()) {
+		// rendering still needs a GL context, but not a visible window
+		ofGLFWWindowSettings settings;
+		settings.setSize(Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
+		settings.visible = false;
+
+		auto window = ofCreateWindow(settings);
+
+		ofRunApp(window, std::make_shared<ofApp>(batchSettings));
+		return ofRunMainLoop();
+	}
 
 	//Use ofGLFWWindowSettings for more options like multi-monitor fullscreen
 	ofGLWindowSettings settings;
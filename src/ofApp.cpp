@@ -1,9 +1,31 @@
 #include "ofApp.h"
-#include "ofxTimeMeasurements.h"
-#include "dkm.hpp"
 
 const int DEFAULT_CIRCLE_RESOLUTION = 32;
 const int FOREGROUND_CIRCLE_RESOLUTION = 96;
+const int FADE_TILE_SIZE = 128;
+const float SCISSOR_MARGIN_PIXELS = 2.0; // around crystals' bounds, for antialiasing
+
+namespace {
+
+void pointBounds(const std::vector<glm::vec2>& points, glm::vec2& min, glm::vec2& max) {
+  min = max = points.empty() ? glm::vec2(0.0) : points[0];
+  for (const auto& point : points) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+}
+
+}
+
+// No audio client in batch mode: the session is read straight from the .oscs or .oscb file, and
+// processed by batchProcessor
+ofApp::ofApp(const BatchSettings& batchSettings_) :
+audioAnalysisClientPtr { nullptr },
+audioDataProcessorPtr { nullptr },
+audioDataPlotsPtr { nullptr },
+audioDataSpectrumPlotsPtr { nullptr },
+batchSettings { batchSettings_ }
+{}
 
 //--------------------------------------------------------------
 void ofApp::setup(){
@@ -12,27 +34,19 @@ void ofApp::setup(){
   ofDisableArbTex(); // required for texture2D to work in GLSL, makes texture coords normalized
   ofSetFrameRate(Constants::FRAME_RATE);
   ofSetCircleResolution(DEFAULT_CIRCLE_RESOLUTION);
-  TIME_SAMPLE_SET_FRAMERATE(Constants::FRAME_RATE);
-
-  double minInstance[3] = { 0.0, 0.0, 0.0 };
-  double maxInstance[3] = { 1.0, 1.0, 1.0 };
-  som.setFeaturesRange(3, minInstance, maxInstance);
-  som.setMapSize(Constants::SOM_WIDTH, Constants::SOM_HEIGHT); // can go to 3 dimensions
-  som.setInitialLearningRate(0.1);
-  som.setNumIterations(3000);
-  som.setup();
+
+  glStageTimer.setup();
+  StageProfiler::instance().setGpuTimer(&glStageTimer);
+
+  // live shows are seeded randomly, batch renders only if no --seed was given
+  if (batchSettings.isEnabled() && batchSettings.seed) {
+    engine.setup(*batchSettings.seed);
+  } else {
+    engine.setup();
+  }
   
   fluidSimulation.setup({ Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT });
   
-  divisionsFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA); // GL_RGBA32F); // 8 bit for ghosts of past lines
-  divisionsFbo.clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  
-  foregroundFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA32F);
-  foregroundFbo.clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  
-  crystalFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGBA);
-  crystalFbo.clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
-  crystalMaskFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_R8);
   maskShader.load();
   
   audioParameters.add(validLowerRmsParameter);
@@ -48,22 +62,25 @@ void ofApp::setup(){
   audioParameters.add(maxSpectralCentroidParameter);
   parameters.add(audioParameters);
 
-  clusterParameters.add(clusterCentresParameter);
-  clusterParameters.add(clusterSourceSamplesMaxParameter);
-  clusterParameters.add(clusterDecayRateParameter);
-  clusterParameters.add(sameClusterToleranceParameter);
-  clusterParameters.add(sampleNoteClustersParameter);
-  clusterParameters.add(sampleNotesParameter);
-  parameters.add(clusterParameters);
-  
+  parameters.add(engine.getClusterParameters());
+  parameters.add(engine.getSomParameters());
+
   fadeParameters.add(fadeCrystalsParameter);
   fadeParameters.add(fadeDivisionsParameter);
   fadeParameters.add(fadeForegroundParameter);
   parameters.add(fadeParameters);
+
+  layerParameters.add(foregroundScaleParameter);
+  layerParameters.add(foregroundFormatParameter);
+  layerParameters.add(divisionsScaleParameter);
+  layerParameters.add(divisionsFormatParameter);
+  layerParameters.add(crystalScaleParameter);
+  layerParameters.add(crystalFormatParameter);
+  layerParameters.add(crystalMaskScaleParameter);
+  layerParameters.add(crystalMaskFormatParameter);
+  parameters.add(layerParameters);
   
-  impulseParameters.add(impulseRadiusParameter);
-  impulseParameters.add(impulseRadialVelocityParameter);
-  parameters.add(impulseParameters);
+  parameters.add(engine.getImpulseParameters());
 
   auto fluidParameterGroup = fluidSimulation.getParameterGroup();
   fluidParameterGroup.getFloat("dt").set(0.02);
@@ -72,43 +89,124 @@ void ofApp::setup(){
   fluidParameterGroup.getFloat("velocity:dissipation").set(0.9999);
   fluidParameterGroup.getInt("pressure:iterations").set(22);
   parameters.add(fluidParameterGroup);
+
+  snapshotParameters.add(snapshotScaleParameter);
+  parameters.add(snapshotParameters);
+
+  profileParameters.add(profileEnabledParameter);
+  parameters.add(profileParameters);
   
   gui.setup(parameters);
 
-  ofxTimeMeasurements::instance()->setEnabled(false);
+  if (batchSettings.isEnabled()) setupBatch();
+  allocateLayers();
 }
 
-//--------------------------------------------------------------
-void ofApp::update() {
-  TS_START("update-introspection");
-  introspector.update();
-  TS_STOP("update-introspection");
+namespace {
 
-  TS_START("update-audoanalysis");
-  audioDataProcessorPtr->update();
-  TS_STOP("update-audoanalysis");
+GLint glInternalFormat(LayerFormat format) {
+  switch (format) {
+    case LayerFormat::RGBA16F: return GL_RGBA16F;
+    case LayerFormat::RGBA32F: return GL_RGBA32F;
+    case LayerFormat::RGB10_A2: return GL_RGB10_A2;
+    case LayerFormat::R8: return GL_R8;
+    case LayerFormat::RGBA8: default: return GL_RGBA8;
+  }
+}
 
-  // fade crystals
-  crystalFbo.begin();
-  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-  ofSetColor(ofFloatColor(0.0, 0.0, 0.0, fadeCrystalsParameter));
-  ofDrawRectangle(0.0, 0.0, crystalFbo.getWidth(), crystalFbo.getHeight());
-  crystalFbo.end();
+}
 
-  // fade division lines
-  divisionsFbo.begin();
-  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-  ofSetColor(ofFloatColor(0.0, 0.0, 0.0, fadeDivisionsParameter));
-  ofDrawRectangle(0.0, 0.0, divisionsFbo.getWidth(), divisionsFbo.getHeight());
-  divisionsFbo.end();
+// (Re)allocates, cleared, any layer whose size or format parameters changed
+bool ofApp::allocateLayer(ofFbo& fbo, float scale, int format) {
+  int width = std::max(1, static_cast<int>(std::round(Constants::CANVAS_WIDTH * scale)));
+  int height = std::max(1, static_cast<int>(std::round(Constants::CANVAS_HEIGHT * scale)));
+  GLint internalFormat = glInternalFormat(static_cast<LayerFormat>(format));
+  if (fbo.isAllocated() && fbo.getWidth() == width && fbo.getHeight() == height
+      && fbo.getTexture().getTextureData().glInternalFormat == internalFormat) return false;
+  fbo.allocate(width, height, internalFormat);
+  fbo.clearColorBuffer(ofFloatColor(0.0, 0.0, 0.0, 0.0));
+  return true;
+}
 
-  // fade foreground
-  foregroundFbo.begin();
-  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-  ofSetColor(ofFloatColor(0.0, 0.0, 0.0, fadeForegroundParameter));
-  ofDrawRectangle(0.0, 0.0, foregroundFbo.getWidth(), foregroundFbo.getHeight());
-  foregroundFbo.end();
+void ofApp::allocateLayers() {
+  bool allocated = allocateLayer(foregroundFbo, foregroundScaleParameter, foregroundFormatParameter);
+  allocated |= allocateLayer(divisionsFbo, divisionsScaleParameter, divisionsFormatParameter);
+  allocated |= allocateLayer(crystalFbo, crystalScaleParameter, crystalFormatParameter);
+  allocated |= allocateLayer(crystalMaskFbo, crystalMaskScaleParameter, crystalMaskFormatParameter);
+  if (!allocated) return;
+
+  crystalTiles.setup(crystalFbo.getWidth(), crystalFbo.getHeight(), FADE_TILE_SIZE);
+  divisionsTiles.setup(divisionsFbo.getWidth(), divisionsFbo.getHeight(), FADE_TILE_SIZE);
+  foregroundTiles.setup(foregroundFbo.getWidth(), foregroundFbo.getHeight(), FADE_TILE_SIZE);
+
+  size_t totalBytes = 0;
+  for (const auto& layer : layerMemory()) {
+    ofLogNotice() << "layers: " << layer.name << " " << layer.width << "x" << layer.height << " " << layerFormatName(layer.format)
+                  << ", " << layer.bytes / (1024 * 1024) << " MB";
+    totalBytes += layer.bytes;
+  }
+  ofLogNotice() << "layers: " << totalBytes / (1024 * 1024) << " MB of canvas layers";
+}
 
+// The canvas layers only: the fluid simulation's buffers, the frozen fluid and the snapshot composite are extra
+std::vector<ofApp::LayerMemory> ofApp::layerMemory() const {
+  auto memory = [](const std::string& name, const ofFbo& fbo, int format) {
+    LayerFormat layerFormat = static_cast<LayerFormat>(format);
+    size_t width = fbo.getWidth();
+    size_t height = fbo.getHeight();
+    return LayerMemory { name, width, height, layerFormat, width * height * layerFormatBytesPerPixel(layerFormat) };
+  };
+  return {
+    memory("foreground", foregroundFbo, foregroundFormatParameter),
+    memory("divisions", divisionsFbo, divisionsFormatParameter),
+    memory("crystal", crystalFbo, crystalFormatParameter),
+    memory("crystalMask", crystalMaskFbo, crystalMaskFormatParameter)
+  };
+}
+
+void ofApp::setupBatch() {
+  bool loaded;
+  if (ofFilePath::getFileExt(batchSettings.sessionPath) == "oscb") {
+    auto mappedSession = std::make_unique<MappedAnalysisRecording>();
+    loaded = mappedSession->load(batchSettings.sessionPath);
+    batchSession = std::move(mappedSession);
+  } else {
+    auto textSession = std::make_unique<OscsReader>();
+    loaded = textSession->load(batchSettings.sessionPath);
+    batchSession = std::move(textSession);
+  }
+  if (!loaded) {
+    ofLogError() << "batch: can't read " << batchSettings.sessionPath;
+    ofExit(1);
+    return;
+  }
+  size_t scalarsNeeded = 1 + std::max({ static_cast<size_t>(ofxAudioAnalysisClient::AnalysisScalar::pitch),
+                                        static_cast<size_t>(ofxAudioAnalysisClient::AnalysisScalar::rootMeanSquare),
+                                        static_cast<size_t>(ofxAudioAnalysisClient::AnalysisScalar::spectralKurtosis),
+                                        static_cast<size_t>(ofxAudioAnalysisClient::AnalysisScalar::spectralCentroid) });
+  if (batchSession->getScalarCount() < scalarsNeeded) {
+    ofLogError() << "batch: " << batchSettings.sessionPath << " has " << batchSession->getScalarCount() << " scalars per frame, expected at least " << scalarsNeeded;
+    ofExit(1);
+    return;
+  }
+  if (!batchSettings.settingsPath.empty()) gui.loadFromFile(batchSettings.settingsPath);
+  profileEnabledParameter = batchSettings.profile;
+  engine.getSomParameters().getBool("somAsync").set(false); // so the same session always renders the same
+
+  if (batchSettings.outputDirectory.empty()) {
+    batchSettings.outputDirectory = ofFilePath::getUserHomeDir() + "/Documents/bells2/" + ofFilePath::getBaseName(batchSettings.sessionPath);
+  }
+  ofDirectory::createDirectory(batchSettings.outputDirectory, false, true);
+
+  // Run frames back to back, with elapsed time stepping by one frame each time
+  ofSetFrameRate(0);
+  ofSetTimeModeFixedRate(ofGetFixedStepForFps(Constants::FRAME_RATE));
+  batchStartMillis = ofGetSystemTimeMillis();
+  ofLogNotice() << "batch: rendering " << batchSession->getDuration() << "s of " << batchSettings.sessionPath << " into " << batchSettings.outputDirectory;
+}
+
+// From the audio client, live
+AudioFrame ofApp::processedAudioFrame() {
   float s = audioDataProcessorPtr->getNormalisedScalarValue(ofxAudioAnalysisClient::AnalysisScalar::pitch, minPitchParameter, maxPitchParameter);// 700.0, 1300.0);
   float t = audioDataProcessorPtr->getNormalisedScalarValue(ofxAudioAnalysisClient::AnalysisScalar::rootMeanSquare, minRMSParameter, maxRMSParameter); ////400.0, 4000.0, false);
   float u = audioDataProcessorPtr->getNormalisedScalarValue(ofxAudioAnalysisClient::AnalysisScalar::spectralKurtosis, minSpectralKurtosisParameter, maxSpectralKurtosisParameter);
@@ -119,416 +217,495 @@ void ofApp::update() {
     {ofxAudioAnalysisClient::AnalysisScalar::pitch, false, validLowerPitchParameter},
     {ofxAudioAnalysisClient::AnalysisScalar::pitch, true, validUpperPitchParameter}
   };
+  bool valid = audioDataProcessorPtr->isDataValid(sampleValiditySpecs);
+  return { s, t, u, v, valid, ofGetElapsedTimef() };
+}
 
-  if (audioDataProcessorPtr->isDataValid(sampleValiditySpecs)) {
-    TS_START("update-som");
-    {
-      double instance[3] = { static_cast<double>(s), static_cast<double>(t), static_cast<double>(v) };
-      som.updateMap(instance);
-    }
-    TS_STOP("update-som");
+// The frame recorded at or before the time, through batchProcessor with the audio parameters in
+// force now, as processedAudioFrame() works it out live
+AudioFrame ofApp::batchAudioFrame(double time) {
+  using ofxAudioAnalysisClient::AnalysisScalar;
+  auto column = [](AnalysisScalar analysisScalar) { return static_cast<size_t>(analysisScalar); };
+  batchProcessor.update(*batchSession, batchSession->frameAt(time));
+  float s = batchProcessor.getNormalisedScalarValue(column(AnalysisScalar::pitch), minPitchParameter, maxPitchParameter);
+  float t = batchProcessor.getNormalisedScalarValue(column(AnalysisScalar::rootMeanSquare), minRMSParameter, maxRMSParameter);
+  float u = batchProcessor.getNormalisedScalarValue(column(AnalysisScalar::spectralKurtosis), minSpectralKurtosisParameter, maxSpectralKurtosisParameter);
+  float v = batchProcessor.getNormalisedScalarValue(column(AnalysisScalar::spectralCentroid), minSpectralCentroidParameter, maxSpectralCentroidParameter);
+
+  std::vector<AnalysisProcessor::ValiditySpec> sampleValiditySpecs {
+    {column(AnalysisScalar::rootMeanSquare), false, validLowerRmsParameter},
+    {column(AnalysisScalar::pitch), false, validLowerPitchParameter},
+    {column(AnalysisScalar::pitch), true, validUpperPitchParameter}
+  };
+  bool valid = batchProcessor.isDataValid(sampleValiditySpecs);
+  return { s, t, u, v, valid, static_cast<float>(time) };
+}
 
-    ofFloatColor somColor = somColorAt(s, t);
-    ofFloatColor darkSomColor = somColor; darkSomColor.setBrightness(0.25); darkSomColor.setSaturation(1.0);
+// Snapshots and plots every so many frames, and stop at the end of the session
+void ofApp::updateBatch() {
+  batchFrame++;
+  char frameName[16];
+  std::snprintf(frameName, sizeof(frameName), "%06zu", batchFrame);
+  const std::string& directory = batchSettings.outputDirectory;
+  if (batchSettings.snapshotInterval > 0 && batchFrame % batchSettings.snapshotInterval == 0) {
+    saveSnapshot(directory + "/snapshot-" + frameName + ".png");
+  }
+  if (batchSettings.plotInterval > 0 && batchFrame % batchSettings.plotInterval == 0) {
+    savePlot(directory + "/plot-" + frameName + ".svg");
+  }
 
-    // Draw foreground mark for raw audio data sample in darkened SOM color
-    foregroundFbo.begin();
-    {
-      ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-      ofSetColor(darkSomColor);
-      ofDrawCircle(s*foregroundFbo.getWidth(), t*foregroundFbo.getHeight(), 10.0);
-    }
-    foregroundFbo.end();
-
-    // Draw fluid mark for raw audio data sample in darkened SOM color
-    fluidSimulation.getFlowValuesFbo().getSource().begin();
-    {
-      ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-      ofSetColor(darkSomColor);
-      ofDrawCircle(s*Constants::FLUID_WIDTH, t*Constants::FLUID_HEIGHT, 3.0);
-    }
-    fluidSimulation.getFlowValuesFbo().getSource().end();
+  if (batchFrame % 1000 == 0) {
+    float seconds = (ofGetSystemTimeMillis() - batchStartMillis) / 1000.0;
+    ofLogNotice() << "batch: frame " << batchFrame << ", " << batchFrame / seconds << " fps";
+  }
 
-    // Maintain recent notes
-    if (recentNoteXYs.size() > clusterSourceSamplesMaxParameter) {
-      recentNoteXYs.erase(recentNoteXYs.end() - clusterSourceSamplesMaxParameter/10, recentNoteXYs.end());
-    }
-    recentNoteXYs.push_back({ s, t });
-    introspector.addCircle(s, t, 1.0/Constants::WINDOW_WIDTH*5.0, ofColor::yellow, true, 30); // introspection: small yellow circle for new raw source sample
-
-    TS_START("update-kmeans");
-    if (recentNoteXYs.size() > clusterCentresParameter) {
-      dkm::clustering_parameters<float> params(clusterCentresParameter);
-      params.set_random_seed(1000); // keep clusters stable
-      clusterResults = dkm::kmeans_lloyd(recentNoteXYs, params);
-    }
-    TS_STOP("update-kmeans");
-    
-    TS_START("update-clusterCentres");
-    {
-      // glm::vec4 w is age
-      // add to clusterCentres from new clusters
-      for (const auto& cluster : std::get<0>(clusterResults)) {
-        float x = cluster[0]; float y = cluster[1];
-        auto it = std::find_if(clusterCentres.begin(),
-                               clusterCentres.end(),
-                               [x, y, this](const glm::vec4& p) {
-          return ((std::abs(p.x-x) < sameClusterToleranceParameter) && (std::abs(p.y-y) < sameClusterToleranceParameter));
-        });
-        if (it == clusterCentres.end()) {
-          // don't have this clusterCentre so make it
-          clusterCentres.push_back(glm::vec4(x, y, 0.0, 1.0)); // start at age=1
-          introspector.addCircle(x, y, 20.0*1.0/Constants::WINDOW_WIDTH, ofColor::red, true, 100); // introspection: large red circle is new cluster centre
-        } else {
-          // existing cluster so add to its age to preserve it
-          it->w++;
-//          introspection.addCircle(it->x, it->y, 3.0*1.0/Constants::WINDOW_WIDTH, ofColor::yellow, false, 10); // introspection: small yellow circle is existing cluster centre that continues to exist
-        }
-      }
-    }
-    TS_STOP("update-clusterCentres");
-    
-    // Make fine structure from some recent notes
-    const std::vector<uint32_t>& recentNoteXYIds = std::get<1>(clusterResults);
-    if (recentNoteXYs.size() > 70) {
-      
-      // find some number of note clusters
-      for (int i = 0; i < sampleNoteClustersParameter; i++) {
-        
-        std::vector<uint32_t> sameClusterNoteIds; // collect note IDs all from the same cluster
-        size_t id = ofRandom(recentNoteXYIds.size()); // start with a random note TODO: don't use ofRandom
-        sameClusterNoteIds.push_back(id);
-        uint32_t clusterId = recentNoteXYIds[id];
-        
-        // pick a number of additional random notes and keep if from this cluster
-        for(int i = 0; i < sampleNotesParameter; i++) {
-          id = ofRandom(recentNoteXYIds.size());
-          if (recentNoteXYIds[id] == clusterId) {
-            sameClusterNoteIds.push_back(id);
-          }
-        }
-
-        // if we found enough related notes then draw something
-        if (sameClusterNoteIds.size() > 2) {
-//          ofLogNotice() << sameClusterNoteIds.size();
-          
-          // make path from notes in normalised coords
-          ofPath path;
-          for (uint32_t id : sameClusterNoteIds) {
-            const auto& note = recentNoteXYs[id];
-            path.lineTo(note[0], note[1]);
-          }
-          path.close();
-
-          // find normalised path bounds
-          ofRectangle pathBounds;
-          for (const auto& polyline : path.getOutline()) {
-            pathBounds = pathBounds.getUnion(polyline.getBoundingBox());
-          }
-          
-          // scale up to some limit to fill mask with a reduced view of some part of the frozen fluid
-          constexpr float MAX_SCALE = 2.0;
-          float scaleX = std::fminf(MAX_SCALE, 1.0 / pathBounds.width);
-          float scaleY = std::fminf(MAX_SCALE, 1.0 / pathBounds.height);
-          float scale = std::fminf(scaleX, scaleY);
-
-          // paint path into the fluid layer
-          fluidSimulation.getFlowValuesFbo().getSource().begin();
-          {
-            ofPath fluidPath = path;
-            fluidPath.scale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
-            ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-            ofFloatColor fillColor = somColor;
-            fillColor.a = 0.3;
-            fluidPath.setColor(fillColor);
-            fluidPath.setFilled(true);
-            fluidPath.draw();
-          }
-          fluidSimulation.getFlowValuesFbo().getSource().end();
-          
-          if (frozenFluid.isAllocated()) {
-
-            // make a mask texture
-            crystalMaskFbo.begin();
-            {
-              ofPath maskPath = path;
-              ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-              ofClear(0, 255);
-              ofSetColor(255);
-              maskPath.setFilled(true);
-              maskPath.scale(crystalMaskFbo.getWidth(), crystalMaskFbo.getHeight());
-              maskPath.draw();
-            }
-            crystalMaskFbo.end();
-            
-            // draw a reduced SOM-tinted version of the frozen fluid into the crystal layer through the mask
-            crystalFbo.begin();
-            {
-              ofEnableBlendMode(OF_BLENDMODE_ADD);
-//              ofFloatColor fragmentColor = somColorAt(pathBounds.x, pathBounds.y);
-//              fragmentColor.a = 0.2;
-//              ofSetColor(fragmentColor*0.2);
-              ofSetColor(128);
-              maskShader.render(frozenFluid, crystalMaskFbo, crystalFbo.getWidth(), crystalFbo.getHeight(), false, {pathBounds.x+pathBounds.width/2.0, pathBounds.y+pathBounds.height/2.0}, {scale, scale});
-            }
-            crystalFbo.end();
-          }
-          
-          // draw extended outlines in the foreground (saving them for redrawing into fluid)
-          std::vector<DividerLine> extendedLines;
-          float width = 8 * 1.0 / divisionsFbo.getWidth();
-          divisionsFbo.begin();
-          ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-          ofSetColor(ofColor::black);
-          ofPushMatrix();
-          ofScale(foregroundFbo.getWidth(), foregroundFbo.getHeight());
-          {
-            for(auto iter = sameClusterNoteIds.begin(); iter < sameClusterNoteIds.end(); iter++) {
-              auto id1 = *iter;
-              const auto& note1 = recentNoteXYs[id1];
-              float x1 = note1[0]; float y1 = note1[1];
-              uint32_t id2;
-              if (iter == sameClusterNoteIds.end() - 1) {
-                id2 = *sameClusterNoteIds.begin();
-              } else {
-                id2 = *(iter + 1);
-              }
-              const auto& note2 = recentNoteXYs[id2];
-              float x2 = note2[0]; float y2 = note2[1];
-              if (note1 == note2) continue;
-              DividerLine line = dividedArea.createConstrainedDividerLine({x1, y1}, {x2, y2});
-              extendedLines.push_back(line);
-              glm::vec2 p1 = line.start; glm::vec2 p2 = line.end;
-              ofPushMatrix();
-              ofTranslate(p1.x, p1.y);
-              ofRotateRad(std::atan2((p2.y-p1.y), (p2.x-p1.x)));
-              ofDrawRectangle(0.0, -width/2.0, ofDist(p1.x, p1.y, p2.x, p2.y), width);
-              ofPopMatrix();
-            }
-          }
-          ofPopMatrix();
-          divisionsFbo.end();
-          
-          // plot connected clustered notes
-          {
-            uint32_t lastNoteId = *(sameClusterNoteIds.end() - 1);
-            auto lastNote = recentNoteXYs[lastNoteId];
-            for (uint32_t id : sameClusterNoteIds) {
-              const auto& note = recentNoteXYs[id];
-              plot.addLine(lastNote[0], lastNote[1], note[0], note[1], ofColor::red, 50);
-              lastNote = note;
-            }
-          }
-
-          // plot extended lines
-          {
-            for (const auto& line : extendedLines) {
-              glm::vec2 p1 = line.start; glm::vec2 p2 = line.end;
-              plot.addLine(p1.x, p1.y, p2.x, p2.y, ofColor::green, 20);
-            }
-          }
-          
-          // redraw extended lines into the fluid layer
-          fluidSimulation.getFlowValuesFbo().getSource().begin();
-          ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-//          ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 0.7));
-          ofSetColor(ofFloatColor(0.0, 0.0, 0.0, 0.3));
-          ofPushMatrix();
-          ofScale(Constants::FLUID_WIDTH, Constants::FLUID_HEIGHT);
-          {
-            float width = 1.0 * 1.0 / Constants::FLUID_WIDTH;
-            for (const auto& line : extendedLines) {
-              glm::vec2 p1 = line.start; glm::vec2 p2 = line.end;
-              ofPushMatrix();
-              ofTranslate(p1.x, p1.y);
-              ofRotateRad(std::atan2((p2.y-p1.y), (p2.x-p1.x)));
-              ofDrawRectangle(0.0, -width/2.0, ofDist(p1.x, p1.y, p2.x, p2.y), width);
-              ofPopMatrix();
-            }
-          }
-          ofPopMatrix();
-          fluidSimulation.getFlowValuesFbo().getSource().end();
-        }
-      }
-    }
+  bool sessionEnded = batchFrame / Constants::FRAME_RATE > batchSession->getDuration();
+  bool frameLimitReached = batchSettings.frameLimit > 0 && batchFrame >= batchSettings.frameLimit;
+  if (sessionEnded || frameLimitReached) {
+    saveSnapshot(directory + "/snapshot-" + frameName + "-final.png");
+    if (batchSettings.profile) saveProfile(directory + "/profile");
+    float seconds = (ofGetSystemTimeMillis() - batchStartMillis) / 1000.0;
+    ofLogNotice() << "batch: rendered " << batchFrame << " frames in " << seconds << "s";
+    ofExit();
+  }
+}
 
-    // draw circles around longer-lasting clusterCentres into fluid layer
-    fluidSimulation.getFlowValuesFbo().getSource().begin();
-    ofEnableBlendMode(OF_BLENDMODE_ADD);
-    ofNoFill();
-    ofSetColor(ofFloatColor(0.1, 0.1, 0.1, 0.6));
-    for (auto& p: clusterCentres) {
-      if (p.w < 5.0) continue;
-      ofDrawCircle(p.x * Constants::FLUID_WIDTH, p.y * Constants::FLUID_HEIGHT, u * 100.0);
-    }
-    fluidSimulation.getFlowValuesFbo().getSource().end();
-
-    TS_START("update-divider");
-    if (clusterCentres.size() > 2) {
-      bool dividedAreaChanged = dividedArea.updateUnconstrainedDividerLines(clusterCentres, {(size_t)ofRandom(clusterCentres.size()), (size_t)ofRandom(clusterCentres.size())});
-      if (dividedAreaChanged) {
-        fluidSimulation.getFlowValuesFbo().getSource().begin();
-        {
-          ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-          ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 0.7));
-          ofPushMatrix();
-          ofScale(Constants::FLUID_WIDTH);
-          const float lineWidth = 0.5 * 1.0 / Constants::FLUID_WIDTH;
-          dividedArea.draw(0.0, lineWidth, 0.0);
-          ofPopMatrix();
-        }
-        fluidSimulation.getFlowValuesFbo().getSource().end();
-        
-        ofPixels frozenPixels;
-        fluidSimulation.getFlowValuesFbo().getSource().getTexture().readToPixels(frozenPixels);
-        frozenFluid.allocate(frozenPixels);
-      }
-    }
-    TS_STOP("update-divider");
-    
-  } //isDataValid()
+//--------------------------------------------------------------
+void ofApp::update() {
+  // A profiled frame runs from here to the end of draw()
+  StageProfiler::instance().setEnabled(profileEnabledParameter);
+  StageProfiler::instance().beginFrame();
+  PROFILE_GPU_STAGE("update");
+
+  allocateLayers();
 
   {
-    TS_START("decay-clusterCentres");
-    // age all clusterCentres
-    for (auto& p: clusterCentres) {
-      p.w -= clusterDecayRateParameter;
-      if (p.w > 5.0) {
-        introspector.addCircle(p.x, p.y, 10.0*1.0/Constants::WINDOW_WIDTH, ofColor::lightGreen, true, 60); // large lightGreen circle is long-lived clusterCentre
-      } else {
-        introspector.addCircle(p.x, p.y, 6.0*1.0/Constants::WINDOW_WIDTH, ofColor::darkOrange, true, 30); // small darkOrange circle is short-lived clusterCentre
-      }
-    }
-    // delete decayed clusterCentres
-    clusterCentres.erase(std::remove_if(clusterCentres.begin(),
-                                        clusterCentres.end(),
-                                        [](const glm::vec4& n) { return n.w <=0; }),
-                         clusterCentres.end());
-    TS_STOP("decay-clusterCentres");
+    PROFILE_STAGE("update-introspection");
+    introspector.update();
   }
-  
-  // draw divisions on foreground
+
+  if (!batchSettings.isEnabled()) {
+    PROFILE_STAGE("update-audioAnalysis");
+    audioDataProcessorPtr->update();
+  }
+
+  // fade crystals
   {
-    divisionsFbo.begin();
-    ofSetColor(ofFloatColor(0.0, 0.0, 0.0, 1.0));
-    ofPushMatrix();
-    ofScale(divisionsFbo.getWidth(), divisionsFbo.getHeight());
-    const float lineWidth = 80.0 * 1.0 / divisionsFbo.getWidth();
-    dividedArea.draw(0.0, lineWidth, 0.0);
-    ofPopMatrix();
-    divisionsFbo.end();
+    PROFILE_GPU_STAGE("fade-crystals");
+    fadeLayer(crystalFbo, crystalTiles, static_cast<LayerFormat>(crystalFormatParameter.get()), fadeCrystalsParameter);
   }
 
-  // draw arcs around longer-lasting clusterCentres into foreground
+  // fade division lines
   {
-    foregroundFbo.begin();
-    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-    ofNoFill();
-    for (auto& p: clusterCentres) {
-      if (p.w < 4.0) continue;
-      ofFloatColor somColor = somColorAt(p.x, p.y);
-      ofFloatColor darkSomColor = somColor; darkSomColor.setBrightness(0.7); darkSomColor.setSaturation(1.0);
-      darkSomColor.a = 0.7;
-      ofSetColor(darkSomColor);
-      ofPolyline path;
-      float radius = std::fmod(p.w*5.0, 480);
-      path.arc(p.x*foregroundFbo.getWidth(), p.y*foregroundFbo.getHeight(), radius, radius, -180.0*(u+p.x), 180.0*(v+p.y), FOREGROUND_CIRCLE_RESOLUTION);
-      path.draw();
-    }
-    foregroundFbo.end();
+    PROFILE_GPU_STAGE("fade-divisions");
+    fadeLayer(divisionsFbo, divisionsTiles, static_cast<LayerFormat>(divisionsFormatParameter.get()), fadeDivisionsParameter);
   }
-  
-  // plot arcs around longer-lasting clusterCentres
+
+  // fade foreground
   {
-    for (auto& p: clusterCentres) {
-      if (p.w < 4.0) continue;
-      float radius = std::fmod(p.w*5.0/Constants::CANVAS_WIDTH, 480.0/Constants::CANVAS_WIDTH);
-      plot.addArc(p.x, p.y, radius, -180.0*(u+p.x), 180.0*(v+p.y), ofColor::blue, 30);
-    }
+    PROFILE_GPU_STAGE("fade-foreground");
+    fadeLayer(foregroundFbo, foregroundTiles, static_cast<LayerFormat>(foregroundFormatParameter.get()), fadeForegroundParameter);
   }
-  
-  // plot divisions
+
+  AudioFrame frame;
+  if (batchSettings.isEnabled()) {
+    frame = batchAudioFrame(batchFrame / Constants::FRAME_RATE);
+  } else {
+    frame = processedAudioFrame();
+  }
+
+  const auto& commands = engine.update(frame);
+
   {
-    for(auto& l : dividedArea.unconstrainedDividerLines) {
-      plot.addLine(l.start.x, l.start.y, l.end.x, l.end.y, ofColor::black, 10);
+    PROFILE_GPU_STAGE("draw-commands");
+    for (const auto& command : commands) {
+      std::visit([this](const auto& c) { drawCommand(c); }, command);
     }
+    drawCrystals();
+    unbindLayer();
   }
 
-  plot.update();
+  {
+    PROFILE_STAGE("update-plot");
+    plot.update();
+  }
 
   {
-    TS_START("update-fluid-clusters");
-    auto& clusterCentres = std::get<0>(clusterResults);
-    for (auto& centre : clusterCentres) {
-      float x = centre[0]; float y = centre[1];
-      const float COL_FACTOR = 0.008;
-      ofFloatColor color = somColorAt(x, y) * COL_FACTOR;
-      color.a = 0.005 * ofRandom(1.0);
-      FluidSimulation::Impulse impulse {
-        { x * Constants::FLUID_WIDTH, y * Constants::FLUID_HEIGHT },
-        Constants::FLUID_WIDTH * impulseRadiusParameter,
-        { 0.0, 0.0 }, // velocity
-        impulseRadialVelocityParameter,
-        color,
-        1.0 // temperature
-      };
-      fluidSimulation.applyImpulse(impulse);
-    }
+    PROFILE_GPU_STAGE("update-fluid");
     fluidSimulation.update();
-    TS_STOP("update-fluid-clusters");
+  }
+
+  if (snapshotExporter.isExporting()) {
+    PROFILE_GPU_STAGE("export-snapshot");
+    snapshotExporter.update();
+  }
+
+  if (batchSettings.isEnabled()) {
+    PROFILE_GPU_STAGE("update-batch");
+    updateBatch();
+  }
+}
+
+// Only the parts of the layer drawn into recently enough to still change when faded
+void ofApp::fadeLayer(ofFbo& fbo, DirtyTiles& tiles, LayerFormat format, float alpha) {
+  tiles.setFade(alpha, format);
+  const auto& regions = tiles.regions();
+  if (regions.empty()) return;
+  fadeMesh.clear();
+  fadeMesh.setMode(OF_PRIMITIVE_TRIANGLES);
+  for (const auto& region : regions) {
+    glm::vec3 topLeft { region.x, region.y, 0.0 };
+    glm::vec3 topRight { region.x + region.width, region.y, 0.0 };
+    glm::vec3 bottomRight { region.x + region.width, region.y + region.height, 0.0 };
+    glm::vec3 bottomLeft { region.x, region.y + region.height, 0.0 };
+    fadeMesh.addVertices({ topLeft, topRight, bottomRight, topLeft, bottomRight, bottomLeft });
+  }
+  fbo.begin();
+  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+  ofSetColor(ofFloatColor(0.0, 0.0, 0.0, alpha));
+  fadeMesh.draw();
+  fbo.end();
+}
+
+// Pixel bounds of what a command drew into a faded layer
+void ofApp::markDrawn(DrawCommands::Layer layer, glm::vec2 min, glm::vec2 max) {
+  const ofFbo& fbo = layerFbo(layer);
+  glm::vec2 size { fbo.getWidth(), fbo.getHeight() };
+  DirtyTiles* tiles;
+  switch (layer) {
+    case DrawCommands::Layer::Foreground: tiles = &foregroundTiles; break;
+    case DrawCommands::Layer::Divisions: tiles = &divisionsTiles; break;
+    case DrawCommands::Layer::Fluid: default:
+#ifdef BELLS_CPU_FLUID
+      fluidSimulation.markValuesDrawn(min / size, max / size); // only that is read back
+#endif
+      return; // the fluid dissipates by itself
+  }
+  tiles->mark(min.x / size.x, min.y / size.y, max.x / size.x, max.y / size.y);
+}
+
+ofFbo& ofApp::layerFbo(DrawCommands::Layer layer) {
+  switch (layer) {
+    case DrawCommands::Layer::Foreground: return foregroundFbo;
+    case DrawCommands::Layer::Divisions: return divisionsFbo;
+    case DrawCommands::Layer::Fluid: default: return fluidSimulation.getFlowValuesFbo().getSource();
   }
 }
 
-ofFloatColor ofApp::somColorAt(float x, float y) const {
-  double* somValue = som.getMapAt(x * Constants::SOM_WIDTH, y * Constants::SOM_HEIGHT);
-  return ofFloatColor(somValue[0], somValue[1], somValue[2], 1.0);
+void ofApp::bindLayer(DrawCommands::Layer layer) {
+  ofFbo& fbo = layerFbo(layer);
+  if (boundLayerFbo == &fbo) return;
+  unbindLayer();
+  fbo.begin();
+  boundLayerFbo = &fbo;
+}
+
+void ofApp::unbindLayer() {
+  if (!boundLayerFbo) return;
+  boundLayerFbo->end();
+  boundLayerFbo = nullptr;
+}
+
+void ofApp::drawCommand(const DrawCommands::Circle& command) {
+  PROFILE_GPU_STAGE("draw-circle");
+  bindLayer(command.layer);
+  const ofFbo& fbo = *boundLayerFbo;
+  ofEnableBlendMode(command.blendMode);
+  if (command.filled) ofFill(); else ofNoFill();
+  ofSetColor(command.color);
+  glm::vec2 centre { command.centre.x * fbo.getWidth(), command.centre.y * fbo.getHeight() };
+  float radius = command.radius * fbo.getWidth();
+  ofDrawCircle(centre.x, centre.y, radius);
+  markDrawn(command.layer, centre - glm::vec2(radius), centre + glm::vec2(radius));
+}
+
+void ofApp::drawCommand(const DrawCommands::Arc& command) {
+  PROFILE_GPU_STAGE("draw-arc");
+  bindLayer(command.layer);
+  const ofFbo& fbo = *boundLayerFbo;
+  ofEnableBlendMode(command.blendMode);
+  ofSetColor(command.color);
+  ofPolyline path;
+  float radius = command.radius * fbo.getWidth();
+  glm::vec2 centre { command.centre.x * fbo.getWidth(), command.centre.y * fbo.getHeight() };
+  path.arc(centre.x, centre.y, radius, radius, command.angleBegin, command.angleEnd, FOREGROUND_CIRCLE_RESOLUTION);
+  path.draw();
+  markDrawn(command.layer, centre - glm::vec2(radius), centre + glm::vec2(radius));
+}
+
+void ofApp::drawCommand(const DrawCommands::Polygon& command) {
+  PROFILE_GPU_STAGE("draw-polygon");
+  bindLayer(command.layer);
+  const ofFbo& fbo = *boundLayerFbo;
+  ofEnableBlendMode(command.blendMode);
+  ofPath path;
+  for (const auto& point : command.points) {
+    path.lineTo(point.x, point.y);
+  }
+  path.close();
+  path.scale(fbo.getWidth(), fbo.getHeight());
+  path.setColor(command.color);
+  path.setFilled(true);
+  path.draw();
+
+  glm::vec2 min, max;
+  pointBounds(command.points, min, max);
+  glm::vec2 size { fbo.getWidth(), fbo.getHeight() };
+  markDrawn(command.layer, min * size, max * size);
+}
+
+void ofApp::drawCommand(const DrawCommands::Lines& command) {
+  PROFILE_GPU_STAGE("draw-lines");
+  bindLayer(command.layer);
+  const ofFbo& fbo = *boundLayerFbo;
+  ofEnableBlendMode(command.blendMode);
+  if (command.filled) ofFill(); else ofNoFill();
+  ofSetColor(command.color);
+  drawLineBatch(command.layer, command.segments, command.width, { fbo.getWidth(), fbo.getHeight() });
+}
+
+void ofApp::drawCommand(const DrawCommands::Divisions& command) {
+  PROFILE_GPU_STAGE("draw-divisions");
+  bindLayer(command.layer);
+  const ofFbo& fbo = *boundLayerFbo;
+  ofEnableBlendMode(command.blendMode);
+  ofSetColor(command.color);
+  glm::vec2 scale { fbo.getWidth(), command.uniformScale ? fbo.getWidth() : fbo.getHeight() };
+  drawLineBatch(command.layer, command.segments, command.lineWidth, scale);
+}
+
+// All the segments in one draw, filled or outlined as the current style says
+void ofApp::drawLineBatch(DrawCommands::Layer layer, const std::vector<DrawCommands::LineSegment>& segments, float width, glm::vec2 scale) {
+  lineBatch.clear(ofGetFill() == OF_FILLED);
+  for (const auto& segment : segments) {
+    lineBatch.add(segment.start, segment.end, width, scale);
+  }
+  if (lineBatch.isEmpty()) return;
+  const auto& vertices = lineBatch.getVertices();
+  const auto& indices = lineBatch.getIndices();
+  lineVbo.setVertexData(vertices.data(), vertices.size(), GL_STREAM_DRAW);
+  lineVbo.setIndexData(indices.data(), indices.size(), GL_STREAM_DRAW);
+  lineVbo.drawElements(lineBatch.isFilled() ? GL_TRIANGLES : GL_LINES, indices.size());
+
+  // each segment on its own, since one box round a whole set of long diagonals covers most of the layer
+  for (const auto& bounds : lineBatch.getSegmentBounds()) {
+    markDrawn(layer, bounds.min, bounds.max);
+  }
+}
+
+// Crystals are deferred so the ones that don't overlap share a mask pass and a crystal pass, each
+// restricted to the crystals' bounds. Nothing else draws into the crystal layer, and they add, so
+// only the frozen fluid changing under them means they have to be drawn first.
+void ofApp::drawCommand(const DrawCommands::Crystal& command) {
+  if (!frozenFluidFbo.isAllocated()) return;
+  glm::vec2 min, max;
+  pointBounds(command.points, min, max);
+  // Each is drawn over its bounds widened as scissorFbo does, in whichever crystal layer is coarser
+  glm::vec2 margin { SCISSOR_MARGIN_PIXELS / std::min(crystalFbo.getWidth(), crystalMaskFbo.getWidth()),
+                     SCISSOR_MARGIN_PIXELS / std::min(crystalFbo.getHeight(), crystalMaskFbo.getHeight()) };
+  for (const auto& pending : pendingCrystals) {
+    bool overlaps = min.x - margin.x <= pending.max.x + margin.x && pending.min.x - margin.x <= max.x + margin.x
+      && min.y - margin.y <= pending.max.y + margin.y && pending.min.y - margin.y <= max.y + margin.y;
+    if (overlaps) {
+      drawCrystals();
+      break;
+    }
+  }
+  pendingCrystals.push_back({ &command, min, max });
+}
+
+namespace {
+
+// Normalised bounds as a pixel scissor rectangle in the fbo, with a margin for antialiasing. FBOs are
+// drawn into with y down from the first row, so there's no flip.
+void scissorFbo(const ofFbo& fbo, glm::vec2 min, glm::vec2 max) {
+  int x0 = std::max(0.0f, std::floor(min.x * fbo.getWidth() - SCISSOR_MARGIN_PIXELS));
+  int y0 = std::max(0.0f, std::floor(min.y * fbo.getHeight() - SCISSOR_MARGIN_PIXELS));
+  int x1 = std::min(fbo.getWidth(), std::ceil(max.x * fbo.getWidth() + SCISSOR_MARGIN_PIXELS));
+  int y1 = std::min(fbo.getHeight(), std::ceil(max.y * fbo.getHeight() + SCISSOR_MARGIN_PIXELS));
+  glScissor(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+}
+
+}
+
+void ofApp::drawCrystals() {
+  if (pendingCrystals.empty()) return;
+  PROFILE_GPU_STAGE("draw-crystals");
+  unbindLayer();
+
+  // make the mask textures, clearing only around each
+  crystalMaskFbo.begin();
+  glEnable(GL_SCISSOR_TEST);
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  for (const auto& crystal : pendingCrystals) {
+    scissorFbo(crystalMaskFbo, crystal.min, crystal.max);
+    ofClear(0, 255);
+    ofPath maskPath;
+    for (const auto& point : crystal.command->points) {
+      maskPath.lineTo(point.x, point.y);
+    }
+    maskPath.close();
+    ofSetColor(255);
+    maskPath.setFilled(true);
+    maskPath.scale(crystalMaskFbo.getWidth(), crystalMaskFbo.getHeight());
+    maskPath.draw();
+  }
+  glDisable(GL_SCISSOR_TEST);
+  crystalMaskFbo.end();
+
+  // draw a reduced SOM-tinted version of the frozen fluid into the crystal layer through each mask
+  crystalFbo.begin();
+  glEnable(GL_SCISSOR_TEST);
+  ofEnableBlendMode(OF_BLENDMODE_ADD);
+  ofSetColor(128);
+  for (const auto& crystal : pendingCrystals) {
+    const auto& command = *crystal.command;
+    scissorFbo(crystalFbo, crystal.min, crystal.max);
+    maskShader.render(frozenFluidFbo.getTexture(), crystalMaskFbo, crystalFbo.getWidth(), crystalFbo.getHeight(), false, command.centre, {command.scale, command.scale});
+    crystalTiles.mark(crystal.min.x, crystal.min.y, crystal.max.x, crystal.max.y); // only the inside of the mask changes
+  }
+  glDisable(GL_SCISSOR_TEST);
+  crystalFbo.end();
+
+  pendingCrystals.clear();
+}
+
+void ofApp::drawCommand(const DrawCommands::FreezeFluid& command) {
+  PROFILE_GPU_STAGE("freeze-fluid");
+  drawCrystals(); // through the fluid as it was frozen before
+  unbindLayer();
+  // Copied on the GPU: reading the pixels back used to stall the frame whenever the divisions changed
+  const ofFbo& fluidFbo = fluidSimulation.getFlowValuesFbo().getSource();
+  if (!frozenFluidFbo.isAllocated() || frozenFluidFbo.getWidth() != fluidFbo.getWidth() || frozenFluidFbo.getHeight() != fluidFbo.getHeight()) {
+    frozenFluidFbo.allocate(fluidFbo.getWidth(), fluidFbo.getHeight(), GL_RGBA); // 8 bit, as the pixels it replaces
+  }
+  frozenFluidFbo.begin();
+  ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+  ofSetColor(255);
+  fluidFbo.draw(0.0, 0.0);
+  frozenFluidFbo.end();
+}
+
+void ofApp::drawCommand(const DrawCommands::FluidImpulse& command) {
+  PROFILE_GPU_STAGE("fluid-impulse");
+  unbindLayer();
+  Fluid::Impulse impulse {
+    { command.position.x * Constants::FLUID_WIDTH, command.position.y * Constants::FLUID_HEIGHT },
+    Constants::FLUID_WIDTH * command.radius,
+    { 0.0, 0.0 }, // velocity
+    command.radialVelocity,
+    command.color,
+    command.temperature
+  };
+  fluidSimulation.applyImpulse(impulse);
+}
+
+void ofApp::drawCommand(const DrawCommands::PlotLine& command) {
+  plot.addLine(command.start.x, command.start.y, command.end.x, command.end.y, command.color, command.lifetime);
+}
+
+void ofApp::drawCommand(const DrawCommands::PlotArc& command) {
+  plot.addArc(command.centre.x, command.centre.y, command.radius, command.angleBegin, command.angleEnd, command.color, command.lifetime);
+}
+
+void ofApp::drawCommand(const DrawCommands::IntrospectorCircle& command) {
+  introspector.addCircle(command.centre.x, command.centre.y, command.radius, command.color, command.filled, command.lifetime);
+}
+
+// The layers as they are drawn to the screen
+void ofApp::drawLayers(float width, float height) {
+  ofPushStyle();
+
+//    ofClear(0, 255);
+
+  // fluid
+  {
+    ofEnableBlendMode(OF_BLENDMODE_DISABLED);
+    ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
+    fluidSimulation.getFlowValuesFbo().getSource().draw(0.0, 0.0, width, height);
+  }
+
+  // foreground
+  {
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
+    foregroundFbo.draw(0, 0, width, height);
+  }
+
+  // divisions
+  {
+    ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+    ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
+    divisionsFbo.draw(0, 0, width, height);
+  }
+
+  // crystals
+  {
+    ofEnableBlendMode(OF_BLENDMODE_ADD);
+    ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
+    crystalFbo.draw(0, 0, width, height);
+  }
+
+  ofPopStyle();
+}
+
+// Composited at canvas size into a reused fbo, which a snapshot export goes on reading from
+void ofApp::composeSnapshot() {
+  if (!compositeFbo.isAllocated()) compositeFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGB);
+  compositeFbo.begin();
+  drawLayers(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
+  compositeFbo.end();
+}
+
+// Blocking, for batch mode where the frame rate doesn't matter
+void ofApp::saveSnapshot(const std::string& path) {
+  PROFILE_GPU_STAGE("save-snapshot");
+  composeSnapshot();
+  ofPixels pixels;
+  compositeFbo.readToPixels(pixels);
+  ofSaveImage(pixels, path, OF_IMAGE_QUALITY_BEST);
+}
+
+void ofApp::exportSnapshot(const std::string& path) {
+  if (snapshotExporter.isExporting()) {
+    ofLogNotice() << "snapshot: still exporting the last one";
+    return;
+  }
+  composeSnapshot();
+  uint32_t width = std::round(Constants::CANVAS_WIDTH * snapshotScaleParameter);
+  uint32_t height = std::round(Constants::CANVAS_HEIGHT * snapshotScaleParameter);
+  ofDirectory::createDirectory(ofFilePath::getEnclosingDirectory(path), false, true);
+  if (!snapshotExporter.start(path, compositeFbo, width, height)) {
+    ofLogError() << "snapshot: can't export " << width << "x" << height << " to " << path;
+  }
+}
+
+void ofApp::savePlot(const std::string& path) {
+  ofBeginSaveScreenAsSVG(path, false, false, ofRectangle(0, 0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT));
+  plot.draw();
+  ofEndSaveScreenAsSVG();
 }
 
 //--------------------------------------------------------------
 void ofApp::draw() {
+  if (batchSettings.isEnabled()) { // nothing to see in the hidden window
+    StageProfiler::instance().endFrame();
+    return;
+  }
+
   if (plot.visible) {
+    PROFILE_GPU_STAGE("draw-plot");
     ofClear(255, 255);
     plot.draw();
     
   } else {
-    ofPushStyle();
-    
-//    ofClear(0, 255);
-    
-    // fluid
-    {
-      ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-      ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-      fluidSimulation.getFlowValuesFbo().getSource().draw(0.0, 0.0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
-    }
-    
-    // foreground
-    {
-      ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-      ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-      foregroundFbo.draw(0, 0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
-    }
-    
-    // divisions
-    {
-      ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-      ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-      divisionsFbo.draw(0, 0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
-    }
-    
-    // crystals
-    {
-      ofEnableBlendMode(OF_BLENDMODE_ADD);
-      ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-      crystalFbo.draw(0, 0, Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
-    }
-
-    ofPopStyle();
+    PROFILE_GPU_STAGE("draw-layers");
+    drawLayers(Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT);
   }
   
   // introspection
   {
-    TS_START("draw-introspection");
+    PROFILE_GPU_STAGE("draw-introspection");
     ofPushStyle();
     ofPushView();
     ofEnableBlendMode(OF_BLENDMODE_ALPHA);
@@ -536,11 +713,11 @@ void ofApp::draw() {
     introspector.draw();
     ofPopView();
     ofPopStyle();
-    TS_STOP("draw-introspection");
   }
   
   // audio analysis graphs
   {
+    PROFILE_GPU_STAGE("draw-audioPlots");
     ofPushStyle();
     ofPushView();
     ofEnableBlendMode(OF_BLENDMODE_ADD);
@@ -552,15 +729,86 @@ void ofApp::draw() {
   }
 
   // gui
-  if (guiVisible) gui.draw();
+  if (guiVisible) {
+    PROFILE_GPU_STAGE("draw-gui");
+    gui.draw();
+  }
+
+  if (profileEnabledParameter) drawProfile();
+  StageProfiler::instance().endFrame();
+}
+
+// Percentiles over the profiler's window, with stages over the frame budget in red
+void ofApp::drawProfile() {
+  const double budgetMillis = 1000.0 / Constants::FRAME_RATE;
+  ofPushStyle();
+  ofEnableBlendMode(OF_BLENDMODE_ALPHA);
+  float y = 20.0;
+  ofDrawBitmapStringHighlight("stage                    cpu p50/p95/p99 ms        gpu p50/p95/p99 ms", 10.0, y);
+  for (const auto& summary : StageProfiler::instance().summarise()) {
+    y += 16.0;
+    char line[128];
+    int length = std::snprintf(line, sizeof(line), "%-24s %6.2f %6.2f %6.2f", summary.name.c_str(), summary.cpu.p50, summary.cpu.p95, summary.cpu.p99);
+    if (summary.hasGpu && length > 0) {
+      std::snprintf(line + length, sizeof(line) - length, "     %6.2f %6.2f %6.2f", summary.gpu.p50, summary.gpu.p95, summary.gpu.p99);
+    }
+    bool overBudget = std::max(summary.cpu.p95, summary.hasGpu ? summary.gpu.p95 : 0.0) > budgetMillis;
+    ofDrawBitmapStringHighlight(line, 10.0, y, ofColor::black, overBudget ? ofColor::red : ofColor::white);
+  }
+  // how much of each faded layer the fade-* stages above covered
+  char line[128];
+  std::snprintf(line, sizeof(line), "faded tiles: crystal %zu/%zu, divisions %zu/%zu, foreground %zu/%zu",
+                crystalTiles.getActiveTileCount(), crystalTiles.getTileCount(),
+                divisionsTiles.getActiveTileCount(), divisionsTiles.getTileCount(),
+                foregroundTiles.getActiveTileCount(), foregroundTiles.getTileCount());
+  y += 16.0;
+  ofDrawBitmapStringHighlight(line, 10.0, y);
+#ifdef BELLS_CPU_FLUID
+  // so the pressure budget can be traded against what's left of the frame
+  const CpuFluidSolver& solver = fluidSimulation.getSolver();
+  std::snprintf(line, sizeof(line), "pressure residual %.4f after %d passes", solver.getPressureResidual(), solver.getPressurePasses());
+  y += 16.0;
+  ofDrawBitmapStringHighlight(line, 10.0, y);
+#endif
+  ofPopStyle();
+}
+
+void ofApp::saveProfile(const std::string& basePath) {
+  const StageProfiler& profiler = StageProfiler::instance();
+  if (!profiler.writeCsv(basePath + ".csv") || !profiler.writeChromeTrace(basePath + ".json")) {
+    ofLogError() << "profile: can't write " << basePath << ".csv/.json";
+    return;
+  }
+  // the layer configuration the timings were for
+  std::ofstream layersFile(basePath + "-layers.csv");
+  layersFile << "layer,width,height,format,bytes\n";
+  for (const auto& layer : layerMemory()) {
+    layersFile << layer.name << "," << layer.width << "," << layer.height << "," << layerFormatName(layer.format) << "," << layer.bytes << "\n";
+  }
+  ofLogNotice() << "profile: written to " << basePath << ".csv, " << basePath << "-layers.csv and " << basePath << ".json";
 }
 
 //--------------------------------------------------------------
 void ofApp::exit(){
+  const SomTrainer& somTrainer = engine.getSomTrainer();
+  if (somTrainer.getDroppedCount() > 0) {
+    ofLogNotice() << "somAsync: " << somTrainer.getUpdateCount() << " SOM updates, "
+                  << somTrainer.getDroppedCount() << " notes dropped with the training queue full";
+  }
+  const dkm::kmeans_statistics& clusterStatistics = engine.getClusterStatistics();
+  if (clusterStatistics.lloyd_distance_evaluations > 0) {
+    // skipped as a share of the point-to-mean distances plain Lloyd iterations would have calculated
+    ofLogNotice() << "clusterAccelerated: " << clusterStatistics.iterations << " iterations, "
+                  << clusterStatistics.distance_evaluations << " distance evaluations, "
+                  << clusterStatistics.distance_evaluations_skipped << " of Lloyd's "
+                  << clusterStatistics.lloyd_distance_evaluations << " skipped ("
+                  << 100.0 * clusterStatistics.distance_evaluations_skipped / clusterStatistics.lloyd_distance_evaluations << "%)";
+  }
 }
 
 //--------------------------------------------------------------
 void ofApp::keyPressed(int key){
+  if (batchSettings.isEnabled()) return;
   if (audioAnalysisClientPtr->keyPressed(key)) return;
   if (key == OF_KEY_TAB) guiVisible = not guiVisible;
   {
@@ -573,45 +821,11 @@ void ofApp::keyPressed(int key){
   if (introspector.keyPressed(key)) return;
   if (plot.keyPressed(key)) return;
   if (key == 'S') {
-    ofFbo compositeFbo;
-    compositeFbo.allocate(Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT, GL_RGB);
-    compositeFbo.begin();
-    {
-      // blackground
-//      ofClear(0, 255);
-
-      // fluid
-      {
-        ofEnableBlendMode(OF_BLENDMODE_DISABLED);
-        ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-        fluidSimulation.getFlowValuesFbo().getSource().draw(0.0, 0.0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
-      }
-      
-      // foreground
-      {
-        ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-        ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-        foregroundFbo.draw(0, 0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
-      }
-      
-      // divisions
-      {
-        ofEnableBlendMode(OF_BLENDMODE_ALPHA);
-        ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-        divisionsFbo.draw(0, 0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
-      }
-      
-      // crystals
-      {
-        ofEnableBlendMode(OF_BLENDMODE_ADD);
-        ofSetColor(ofFloatColor(1.0, 1.0, 1.0, 1.0));
-        crystalFbo.draw(0, 0, Constants::CANVAS_WIDTH, Constants::CANVAS_HEIGHT);
-      }
-    }
-    compositeFbo.end();
-    ofPixels pixels;
-    compositeFbo.readToPixels(pixels);
-    ofSaveImage(pixels, ofFilePath::getUserHomeDir()+"/Documents/bells2/snapshot-"+ofGetTimestampString()+".png", OF_IMAGE_QUALITY_BEST);
+    exportSnapshot(ofFilePath::getUserHomeDir()+"/Documents/bells2/snapshot-"+ofGetTimestampString()+".tif");
+  }
+  if (key == 'P') profileEnabledParameter = not profileEnabledParameter;
+  if (key == 'E') {
+    saveProfile(ofFilePath::getUserHomeDir()+"/Documents/bells2/profile-"+ofGetTimestampString());
   }
 }
 
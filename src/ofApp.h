@@ -2,19 +2,36 @@
 
 #include "ofMain.h"
 #include "ofxGui.h"
-#include "ofxSelfOrganizingMap.h"
 #include "ofxAudioAnalysisClient.h"
 #include "ofxAudioData.h"
+#ifdef BELLS_CPU_FLUID
+#include "CpuFluidSimulation.h"
+#else
 #include "FluidSimulation.h"
+#endif
 #include "MaskShader.h"
 #include "ofxIntrospector.h"
 #include "ofxPlottable.h"
 #include "Constants.h"
 #include "ofxDividedArea.h"
+#include "BellsEngine.h"
+#include "BatchSettings.h"
+#include "OscsReader.h"
+#include "MappedAnalysisRecording.h"
+#include "AnalysisProcessor.h"
+#include "StageProfiler.h"
+#include "GlStageTimer.h"
+#include "SnapshotExporter.h"
+#include "LineBatch.h"
+#include "DirtyTiles.h"
+#include "LayerFormat.h"
 
 class ofApp : public ofBaseApp{
   
 public:
+  ofApp() = default;
+  explicit ofApp(const BatchSettings& batchSettings); // render a recorded session offline instead of playing it
+
   void setup() override;
   void update() override;
   void draw() override;
@@ -54,11 +71,37 @@ private:
   std::shared_ptr<ofxAudioData::Plots> audioDataPlotsPtr { std::make_shared<ofxAudioData::Plots>(audioDataProcessorPtr) };
   std::shared_ptr<ofxAudioData::SpectrumPlots> audioDataSpectrumPlotsPtr { std::make_shared<ofxAudioData::SpectrumPlots>(audioDataProcessorPtr) };
   
-  ofxSelfOrganizingMap som;
-  ofFloatColor somColorAt(float x, float y) const;
+  BellsEngine engine;
+
+  BatchSettings batchSettings;
+  std::unique_ptr<AnalysisRecording> batchSession;
+  AnalysisProcessor batchProcessor;
+  size_t batchFrame { 0 };
+  uint64_t batchStartMillis;
+  void setupBatch();
+  AudioFrame processedAudioFrame();
+  AudioFrame batchAudioFrame(double time);
+  void updateBatch();
+  void saveSnapshot(const std::string& path);
+  void savePlot(const std::string& path);
+
+  void drawLayers(float width, float height);
+  ofFbo compositeFbo;
+  void composeSnapshot();
+  SnapshotExporter snapshotExporter;
+  void exportSnapshot(const std::string& path); // tiled TIFF, over the next frames
+
+  GlStageTimer glStageTimer;
+  void drawProfile();
+  void saveProfile(const std::string& basePath); // .csv summary and .json Chrome trace
   
-  FluidSimulation fluidSimulation;
-  ofTexture frozenFluid;
+#ifdef BELLS_CPU_FLUID
+  using Fluid = CpuFluidSimulation;
+#else
+  using Fluid = FluidSimulation;
+#endif
+  Fluid fluidSimulation;
+  ofFbo frozenFluidFbo; // fluid values when the divisions last changed, for the crystals
 
   ofFbo foregroundFbo; // transient lines and circles
   
@@ -67,12 +110,53 @@ private:
   MaskShader maskShader;
   
   ofFbo divisionsFbo;
-  DividedArea dividedArea { {1.0, 1.0}, 7 };
 
-  std::vector<std::array<float, 2>> recentNoteXYs;
-  std::tuple<std::vector<std::array<float, 2>>, std::vector<uint32_t>> clusterResults;
-  std::vector<glm::vec4> clusterCentres;
-  
+  // Each layer's size (as a fraction of the canvas) and format come from the layer parameters
+  bool allocateLayer(ofFbo& fbo, float scale, int format);
+  void allocateLayers();
+  struct LayerMemory {
+    std::string name;
+    size_t width, height;
+    LayerFormat format;
+    size_t bytes;
+  };
+  std::vector<LayerMemory> layerMemory() const;
+
+  // Executing the engine's DrawCommands, keeping a layer's fbo bound across consecutive commands for it
+  void drawCommand(const DrawCommands::Circle& command);
+  void drawCommand(const DrawCommands::Arc& command);
+  void drawCommand(const DrawCommands::Polygon& command);
+  void drawCommand(const DrawCommands::Lines& command);
+  void drawCommand(const DrawCommands::Divisions& command);
+  void drawCommand(const DrawCommands::Crystal& command);
+  void drawCommand(const DrawCommands::FreezeFluid& command);
+  void drawCommand(const DrawCommands::FluidImpulse& command);
+  void drawCommand(const DrawCommands::PlotLine& command);
+  void drawCommand(const DrawCommands::PlotArc& command);
+  void drawCommand(const DrawCommands::IntrospectorCircle& command);
+  ofFbo& layerFbo(DrawCommands::Layer layer);
+  void bindLayer(DrawCommands::Layer layer);
+  void unbindLayer();
+  ofFbo* boundLayerFbo { nullptr };
+  LineBatch lineBatch;
+  ofVbo lineVbo;
+  void drawLineBatch(DrawCommands::Layer layer, const std::vector<DrawCommands::LineSegment>& segments, float width, glm::vec2 scale);
+
+  // Fading only what is still fading
+  DirtyTiles crystalTiles;
+  DirtyTiles divisionsTiles;
+  DirtyTiles foregroundTiles;
+  ofMesh fadeMesh;
+  void fadeLayer(ofFbo& fbo, DirtyTiles& tiles, LayerFormat format, float alpha);
+  void markDrawn(DrawCommands::Layer layer, glm::vec2 min, glm::vec2 max);
+
+  struct PendingCrystal {
+    const DrawCommands::Crystal* command; // in the engine's commands for this frame
+    glm::vec2 min, max; // normalised bounds
+  };
+  std::vector<PendingCrystal> pendingCrystals;
+  void drawCrystals();
+
   Plottable plot { Constants::WINDOW_WIDTH, Constants::WINDOW_HEIGHT }; // We draw in normalised coords so scale up for drawing and saving into a window-shaped viewport
   
   Introspector introspector; // add things to this in normalised coords
@@ -94,23 +178,29 @@ private:
   ofParameter<float> minSpectralCentroidParameter { "minCentroidKurtosis", 0.4, 0.0, 10.0 };
   ofParameter<float> maxSpectralCentroidParameter { "maxCentroidKurtosis", 6.0, 0.0, 10.0 };
 
-  ofParameterGroup clusterParameters { "cluster" };
-  ofParameter<int> clusterCentresParameter { "clusterCentres", 12, 2.0, 50.0 };
-  ofParameter<int> clusterSourceSamplesMaxParameter { "clusterSourceSamplesMax", 3000, 1000, 8000 }; // Note: 1600 raw samples per frame at 30fps
-  ofParameter<float> clusterDecayRateParameter { "clusterDecayRate", 1.1, 0.0, 5.0 };
-  ofParameter<float> sameClusterToleranceParameter { "sameClusterTolerance", 0.1, 0.01, 1.0 };
-  ofParameter<int> sampleNoteClustersParameter { "sampleNoteClusters", 7, 1, 20 };
-  ofParameter<int> sampleNotesParameter { "sampleNotes", 7, 1, 20 };
-
   ofParameterGroup fadeParameters { "fade" };
   ofParameter<float> fadeCrystalsParameter { "fadeCrystals", 0.01, 0.001, 0.1 };
   ofParameter<float> fadeDivisionsParameter { "fadeDivisions", 0.06, 0.001, 0.1 };
   ofParameter<float> fadeForegroundParameter { "fadeForeground", 0.005, 0.001, 0.1 };
-  
-  ofParameterGroup impulseParameters { "impulse" };
-  ofParameter<float> impulseRadiusParameter { "impulseRadius", 0.085, 0.01, 0.2 };
-  ofParameter<float> impulseRadialVelocityParameter { "impulseRadialVelocity", 0.0003, 0.0001, 0.001 };
 
+  // Formats numbered as LayerFormat: 0 RGBA8, 1 RGBA16F, 2 RGBA32F, 3 RGB10_A2, 4 R8. Changes reallocate
+  // (and clear) the layer on the next frame.
+  ofParameterGroup layerParameters { "layers" };
+  ofParameter<float> foregroundScaleParameter { "foregroundScale", 1.0, 0.25, 1.0 };
+  ofParameter<int> foregroundFormatParameter { "foregroundFormat", static_cast<int>(LayerFormat::RGBA32F), 0, LAYER_FORMAT_COUNT - 1 };
+  ofParameter<float> divisionsScaleParameter { "divisionsScale", 1.0, 0.25, 1.0 };
+  ofParameter<int> divisionsFormatParameter { "divisionsFormat", static_cast<int>(LayerFormat::RGBA8), 0, LAYER_FORMAT_COUNT - 1 }; // 8 bit for ghosts of past lines
+  ofParameter<float> crystalScaleParameter { "crystalScale", 1.0, 0.25, 1.0 };
+  ofParameter<int> crystalFormatParameter { "crystalFormat", static_cast<int>(LayerFormat::RGBA8), 0, LAYER_FORMAT_COUNT - 1 };
+  ofParameter<float> crystalMaskScaleParameter { "crystalMaskScale", 1.0, 0.25, 1.0 };
+  ofParameter<int> crystalMaskFormatParameter { "crystalMaskFormat", static_cast<int>(LayerFormat::R8), 0, LAYER_FORMAT_COUNT - 1 };
+
+  ofParameterGroup snapshotParameters { "snapshot" };
+  ofParameter<float> snapshotScaleParameter { "snapshotScale", 1.0, 0.25, 4.0 }; // of the canvas, for 'S'
+
+  ofParameterGroup profileParameters { "profile" };
+  ofParameter<bool> profileEnabledParameter { "profileEnabled", false }; // also 'P', and 'E' to export
+  
   // draw extended outlines in the foreground (saving them for redrawing into fluid)
   //  float width = 15 * 1.0 / foregroundLinesFbo.getWidth();
   // redraw extended lines into the fluid layer
@@ -0,0 +1,81 @@
+// A session converted from .oscs to .oscb keeps every raw column, spectrum bins included, and
+// replays through AnalysisProcessor to exactly the features the text session gives.
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "AnalysisProcessor.h"
+#include "MappedAnalysisRecording.h"
+#include "OscsReader.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+const char* SESSION_PATH = "AnalysisRecordingTest.oscs";
+const char* CONVERTED_PATH = "AnalysisRecordingTest.oscb";
+const size_t FRAME_COUNT = 500;
+const size_t SCALAR_COUNT = 12; // a few scalars then spectrum bins
+
+// Every 23ms like the recorder, with scalars that move about and a comment line to skip
+void writeSession() {
+  std::ofstream file(SESSION_PATH);
+  file << "# test session\n";
+  for (size_t frame = 0; frame < FRAME_COUNT; frame++) {
+    file << frame * 23;
+    for (size_t scalar = 0; scalar < SCALAR_COUNT; scalar++) file << ' ' << (frame * 7 + scalar * 13) % 101 + 0.25f * scalar;
+    file << '\n';
+  }
+}
+
+void checkColumns(const AnalysisRecording& session, const AnalysisRecording& converted) {
+  check(converted.size() == session.size() && converted.getScalarCount() == session.getScalarCount(), "converted frame and column counts");
+  if (converted.size() != session.size() || converted.getScalarCount() != session.getScalarCount()) return;
+  bool same = true;
+  for (size_t frame = 0; frame < session.size(); frame++) {
+    same = same && converted.getTime(frame) == session.getTime(frame);
+    for (size_t scalar = 0; scalar < session.getScalarCount(); scalar++) {
+      same = same && converted.getScalar(frame, scalar) == session.getScalar(frame, scalar);
+    }
+  }
+  check(same, "converted columns are the raw columns");
+}
+
+// Stepped on a 20fps clock as batch mode does, with a validity spec on one column and a range on another
+void checkReplay(const AnalysisRecording& session, const AnalysisRecording& converted) {
+  AnalysisProcessor sessionProcessor, convertedProcessor;
+  std::vector<AnalysisProcessor::ValiditySpec> specs { { 1, false, 20.0f }, { 0, true, 90.0f } };
+  bool same = true;
+  for (size_t batchFrame = 0; batchFrame / 20.0 <= session.getDuration(); batchFrame++) {
+    double time = batchFrame / 20.0;
+    sessionProcessor.update(session, session.frameAt(time));
+    convertedProcessor.update(converted, converted.frameAt(time));
+    same = same && sessionProcessor.getNormalisedScalarValue(2, 10.0f, 80.0f) == convertedProcessor.getNormalisedScalarValue(2, 10.0f, 80.0f);
+    same = same && sessionProcessor.isDataValid(specs) == convertedProcessor.isDataValid(specs);
+  }
+  check(same, "converted session replays to the same features");
+}
+
+}
+
+int main() {
+  writeSession();
+  OscsReader session;
+  check(session.load(SESSION_PATH), "session loads");
+  check(session.size() == FRAME_COUNT && session.getScalarCount() == SCALAR_COUNT, "session frame and column counts");
+  check(MappedAnalysisRecording::write(session, CONVERTED_PATH), "session converts");
+  MappedAnalysisRecording converted;
+  check(converted.load(CONVERTED_PATH), "converted session loads");
+  checkColumns(session, converted);
+  checkReplay(session, converted);
+  std::remove(SESSION_PATH);
+  std::remove(CONVERTED_PATH);
+
+  std::printf("%s\n", failures ? "AnalysisRecordingTest failed" : "AnalysisRecordingTest passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// DirtyTiles against a CPU reference of the fade: a layer faded only in regions() every frame must
+// come out identical to the same layer faded everywhere, whatever is drawn into it and however
+// the fade changes. The fade is OF_BLENDMODE_ALPHA with black at the fade's alpha, rounded to the
+// format's levels as the GPU writes it, so colour settles towards 0 and alpha towards the fade's
+// alpha. regions() mustn't fade a pixel twice in a frame, and a new fade re-marks every tile even
+// when it settles in as many frames as the old one.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "DirtyTiles.h"
+#include "Xoshiro256.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+const size_t WIDTH = 300, HEIGHT = 170; // not a multiple of the tile size
+const size_t TILE_SIZE = 32;
+
+// Colour and alpha, in the format's levels
+struct Layer {
+  std::vector<float> colour, alpha;
+  Layer() : colour(WIDTH * HEIGHT, 0.0f), alpha(WIDTH * HEIGHT, 0.0f) {}
+  bool operator==(const Layer& other) const { return colour == other.colour && alpha == other.alpha; }
+};
+
+void fadePixel(Layer& layer, size_t i, float alpha, float levels) {
+  layer.colour[i] = std::nearbyint(layer.colour[i] * (1.0f - alpha));
+  layer.alpha[i] = std::nearbyint(alpha * alpha * levels + layer.alpha[i] * (1.0f - alpha));
+}
+
+void drawRect(Layer& layer, Layer& reference, DirtyTiles& tiles, Xoshiro256& random, float levels) {
+  size_t x0 = random.index(WIDTH), y0 = random.index(HEIGHT);
+  size_t x1 = std::min(WIDTH, x0 + 1 + random.index(60)), y1 = std::min(HEIGHT, y0 + 1 + random.index(40));
+  float colour = std::nearbyint(random.uniform() * levels);
+  for (size_t y = y0; y < y1; y++) {
+    for (size_t x = x0; x < x1; x++) {
+      layer.colour[y * WIDTH + x] = reference.colour[y * WIDTH + x] = colour;
+      layer.alpha[y * WIDTH + x] = reference.alpha[y * WIDTH + x] = levels;
+    }
+  }
+  // the geometric bounds, as the app marks them
+  tiles.mark(float(x0) / WIDTH, float(y0) / HEIGHT, float(x1) / WIDTH, float(y1) / HEIGHT);
+}
+
+struct Fade {
+  float alpha;
+  size_t frames;
+};
+
+void checkAgainstReference(LayerFormat format, const std::vector<Fade>& fades, const char* what) {
+  float levels = std::round(1.0 / layerFormatPrecision(format));
+  Xoshiro256 random(7);
+  DirtyTiles tiles;
+  tiles.setup(WIDTH, HEIGHT, TILE_SIZE);
+  Layer layer, reference;
+  std::vector<uint32_t> fadedCounts(WIDTH * HEIGHT);
+  bool same = true, once = true, settled = false;
+  for (const auto& fade : fades) {
+    for (size_t frame = 0; frame < fade.frames; frame++) {
+      tiles.setFade(fade.alpha, format);
+      for (size_t y = 0; y < HEIGHT; y++) {
+        for (size_t x = 0; x < WIDTH; x++) fadePixel(reference, y * WIDTH + x, fade.alpha, levels);
+      }
+      std::fill(fadedCounts.begin(), fadedCounts.end(), 0);
+      const auto& regions = tiles.regions();
+      for (const auto& region : regions) {
+        for (size_t y = region.y; y < region.y + region.height; y++) {
+          for (size_t x = region.x; x < region.x + region.width; x++) {
+            fadePixel(layer, y * WIDTH + x, fade.alpha, levels);
+            once = once && ++fadedCounts[y * WIDTH + x] == 1;
+          }
+        }
+      }
+      settled = settled || regions.empty();
+      same = same && layer == reference;
+      // draw now and then, and leave long enough gaps for everything to settle
+      if (frame % 200 < 20 && random.index(3) == 0) drawRect(layer, reference, tiles, random, levels);
+    }
+  }
+  check(same, what);
+  check(once, "no pixel is faded twice in a frame");
+  check(settled, "the whole layer settles between draws");
+}
+
+// A change of fade needs everything faded again even when it settles in the same number of frames
+void checkRemarking() {
+  check(DirtyTiles::settleFramesFor(0.3f, LayerFormat::RGBA8) == DirtyTiles::settleFramesFor(0.301f, LayerFormat::RGBA8),
+        "two fades that settle in the same number of frames");
+  check(DirtyTiles::settleFramesFor(0.1f, LayerFormat::RGB10_A2) == DirtyTiles::settleFramesFor(0.1f, LayerFormat::RGBA16F),
+        "two formats that settle in the same number of frames");
+  DirtyTiles tiles;
+  tiles.setup(WIDTH, HEIGHT, TILE_SIZE);
+  auto settle = [&tiles]() {
+    for (int frame = 0; frame < 1000 && !tiles.regions().empty(); frame++) {}
+  };
+  tiles.setFade(0.3f, LayerFormat::RGBA8);
+  settle();
+  check(tiles.regions().empty() && tiles.getActiveTileCount() == 0, "settles");
+  tiles.setFade(0.301f, LayerFormat::RGBA8);
+  check(tiles.regions().size() > 0 && tiles.getActiveTileCount() == tiles.getTileCount(), "a new alpha fades every tile again");
+  settle();
+  tiles.setFade(0.1f, LayerFormat::RGB10_A2);
+  settle();
+  tiles.setFade(0.1f, LayerFormat::RGBA16F);
+  check(tiles.getTileCount() > 0 && tiles.regions().size() > 0 && tiles.getActiveTileCount() == tiles.getTileCount(), "a new format fades every tile again");
+  settle();
+  tiles.setFade(0.1f, LayerFormat::RGBA16F);
+  check(tiles.regions().empty(), "the same fade again doesn't");
+}
+
+}
+
+int main() {
+  checkAgainstReference(LayerFormat::RGBA8, { { 0.3f, 600 }, { 0.05f, 600 }, { 0.6f, 400 } },
+                        "faded regions match fading everything, RGBA8");
+  checkAgainstReference(LayerFormat::RGB10_A2, { { 0.1f, 600 }, { 0.02f, 800 } },
+                        "faded regions match fading everything, RGB10_A2");
+  checkRemarking();
+
+  std::printf("%s\n", failures ? "DirtyTilesTest failed" : "DirtyTilesTest passed");
+  return failures ? 1 : 0;
+}
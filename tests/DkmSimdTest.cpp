@@ -0,0 +1,93 @@
+// The vectorised nearest-mean kernels against the scalar one they have to match bit for bit,
+// including over the leftover points and with tied means. Built with -ffp-contract=fast (see the
+// Makefile) so a fused multiply-add in the scalar code would show up here.
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "dkm.hpp"
+
+namespace {
+
+using Point = std::array<float, 2>;
+using namespace dkm::details::simd;
+using Kernel = void (*)(const Point*, size_t, const means_2d&, uint32_t*, float*);
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+std::vector<Point> randomPoints(size_t count, std::mt19937& random) {
+  std::vector<Point> points(count);
+  for (auto& point : points) {
+    // canvas-like coordinates, so distances lose low bits and rounding differences would show
+    point = { static_cast<float>(random() % 1000000) * 0.0137f, static_cast<float>(random() % 1000000) * 0.0071f };
+  }
+  return points;
+}
+
+void compareKernel(const char* name, Kernel kernel, const std::vector<Point>& points, const means_2d& lanes) {
+  size_t count = points.size();
+  std::vector<uint32_t> expectedLabels(count), labels(count);
+  std::vector<float> expectedDistances(count), distances(count);
+  closest_means_scalar(points.data(), count, lanes, expectedLabels.data(), expectedDistances.data());
+  kernel(points.data(), count, lanes, labels.data(), distances.data());
+  char what[128];
+  std::snprintf(what, sizeof(what), "%s labels match the scalar kernel", name);
+  check(labels == expectedLabels, what);
+  std::snprintf(what, sizeof(what), "%s distances match the scalar kernel bit for bit", name);
+  check(std::memcmp(distances.data(), expectedDistances.data(), count * sizeof(float)) == 0, what);
+
+  // either output can be left out
+  std::vector<uint32_t> labelsOnly(count);
+  kernel(points.data(), count, lanes, labelsOnly.data(), nullptr);
+  std::snprintf(what, sizeof(what), "%s labels without distances", name);
+  check(labelsOnly == expectedLabels, what);
+}
+
+}
+
+int main() {
+  std::mt19937 random { 7 };
+  // an odd count leaves points for the scalar tail of every kernel
+  std::vector<Point> points = randomPoints(8003, random);
+  std::vector<Point> means = randomPoints(50, random);
+  means[17] = means[3]; // ties go to the lower index
+  means[40] = means[3];
+  means_2d lanes;
+  transpose_means(means, lanes);
+
+  // the generic search agrees on the labels
+  std::vector<uint32_t> labels(points.size());
+  closest_means_scalar(points.data(), points.size(), lanes, labels.data(), nullptr);
+  bool genericMatches = true;
+  for (size_t i = 0; i < points.size(); i++) {
+    genericMatches &= dkm::details::closest_mean(points[i], means) == labels[i];
+  }
+  check(genericMatches, "scalar kernel labels match closest_mean");
+  std::vector<float> distances(points.size());
+  closest_means_scalar(points.data(), points.size(), lanes, nullptr, distances.data());
+  bool genericDistancesMatch = true;
+  for (size_t i = 0; i < points.size(); i++) {
+    float distance = dkm::details::distance_squared(points[i], means[labels[i]]);
+    genericDistancesMatch &= std::memcmp(&distance, &distances[i], sizeof(float)) == 0;
+  }
+  check(genericDistancesMatch, "scalar kernel distances match distance_squared bit for bit");
+  bool noneTiedHigh = true;
+  for (uint32_t label : labels) noneTiedHigh &= label != 17 && label != 40;
+  check(noneTiedHigh, "tied means resolve to the lowest index");
+
+#if DKM_HAS_SSE2
+  compareKernel("sse2", closest_means_sse2, points, lanes);
+#endif
+#if DKM_HAS_AVX2
+  if (__builtin_cpu_supports("avx2")) compareKernel("avx2", closest_means_avx2, points, lanes);
+#endif
+  compareKernel("dispatch", closest_means, points, lanes);
+
+  std::printf("%s\n", failures ? "DkmSimdTest failed" : "DkmSimdTest passed");
+  return failures ? 1 : 0;
+}
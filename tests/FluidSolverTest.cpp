@@ -0,0 +1,116 @@
+// CpuFluidSolver's pressure solves against themselves: more Jacobi iterations or more V-cycles leave
+// a smaller residual, each well below the divergence it started from, and a V-cycle does more than
+// a long run of Jacobi iterations. Every pass is split into bands of rows for the thread pool, so
+// the fields must come out bit for bit the same on one thread as on several.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "CpuFluidSolver.h"
+#include "Xoshiro256.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+// Odd sizes, so the multigrid levels don't halve evenly, and many bands of rows
+const size_t WIDTH = 131, HEIGHT = 67;
+const int STEPS = 8;
+
+// Impulses at wandering positions each step, as FluidBenchmark adds them
+void addImpulses(CpuFluidSolver& solver, Xoshiro256& random) {
+  for (int i = 0; i < 6; i++) {
+    float x = random.uniform() * WIDTH;
+    float y = random.uniform() * HEIGHT;
+    float vx = (random.uniform() - 0.5f) * 40.0f;
+    float vy = (random.uniform() - 0.5f) * 40.0f;
+    solver.applyImpulse({ x, y, 9.0f, vx, vy, 3.0f, { 0.2f, 0.1f, 0.3f, 0.5f * random.uniform() }, random.uniform() });
+  }
+}
+
+// The same impulses and steps every time, so only the parameters or threads differ
+void run(CpuFluidSolver& solver, const CpuFluidSolver::Parameters& parameters, size_t threads) {
+  solver.setup(WIDTH, HEIGHT);
+  solver.setThreadCount(threads);
+  Xoshiro256 random { 3 };
+  for (int step = 0; step < STEPS; step++) {
+    addImpulses(solver, random);
+    solver.step(parameters);
+  }
+}
+
+CpuFluidSolver::Parameters jacobi(int iterations) {
+  CpuFluidSolver::Parameters parameters;
+  parameters.pressureIterations = iterations;
+  return parameters;
+}
+
+CpuFluidSolver::Parameters multigrid(int cycles) {
+  CpuFluidSolver::Parameters parameters;
+  parameters.multigrid = true;
+  parameters.targetResidual = 0.0; // always the full number of cycles
+  parameters.maxCycles = cycles;
+  return parameters;
+}
+
+float residualAfter(const CpuFluidSolver::Parameters& parameters) {
+  CpuFluidSolver solver;
+  run(solver, parameters, 1);
+  return solver.getPressureResidual();
+}
+
+void checkResiduals() {
+  float jacobi10 = residualAfter(jacobi(10));
+  float jacobi40 = residualAfter(jacobi(40));
+  float jacobi160 = residualAfter(jacobi(160));
+  check(jacobi10 < 1.0f, "Jacobi iterations reduce the residual below the divergence");
+  check(jacobi40 < jacobi10 && jacobi160 < jacobi40, "more Jacobi iterations leave a smaller residual");
+
+  float cycles1 = residualAfter(multigrid(1));
+  float cycles2 = residualAfter(multigrid(2));
+  float cycles4 = residualAfter(multigrid(4));
+  check(cycles1 < 1.0f, "a V-cycle reduces the residual below the divergence");
+  check(cycles2 < cycles1 && cycles4 < cycles2, "more V-cycles leave a smaller residual");
+  check(cycles1 < jacobi40, "a V-cycle does more than 40 Jacobi iterations");
+
+  CpuFluidSolver::Parameters targeted = multigrid(20);
+  targeted.targetResidual = 0.01;
+  CpuFluidSolver solver;
+  run(solver, targeted, 1);
+  check(solver.getPressureResidual() <= 0.01f && solver.getPressurePasses() < 20, "V-cycles stop at the target residual");
+}
+
+bool sameField(const float* a, const float* b) {
+  return std::memcmp(a, b, WIDTH * HEIGHT * sizeof(float)) == 0;
+}
+
+void checkThreads(const CpuFluidSolver::Parameters& parameters, const char* what) {
+  CpuFluidSolver single, multiple;
+  run(single, parameters, 1);
+  run(multiple, parameters, 4);
+  bool same = sameField(single.getVelocityX(), multiple.getVelocityX())
+    && sameField(single.getVelocityY(), multiple.getVelocityY())
+    && sameField(single.getPressure(), multiple.getPressure())
+    && single.getPressureResidual() == multiple.getPressureResidual()
+    && single.getPressurePasses() == multiple.getPressurePasses();
+  for (size_t channel = 0; channel < CpuFluidSolver::VALUE_CHANNELS; channel++) {
+    same = same && sameField(single.getValues(channel), multiple.getValues(channel));
+  }
+  check(same, what);
+}
+
+}
+
+int main() {
+  checkResiduals();
+  checkThreads(jacobi(22), "Jacobi steps are identical on 1 and 4 threads");
+  checkThreads(multigrid(3), "multigrid steps are identical on 1 and 4 threads");
+
+  std::printf("%s\n", failures ? "FluidSolverTest failed" : "FluidSolverTest passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+// kmeans_lloyd with a caller-owned workspace, and the per-frame kmeans_state updates, mustn't
+// allocate once their buffers have grown: every allocation is counted by replacing operator new.
+// The workspace kmeans_lloyd, and kmeans_hamerly, which only skips distances that can't change a
+// label, must give exactly kmeans_lloyd's means and labels.
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include "dkm.hpp"
+#include "dkm_parallel.hpp"
+
+namespace {
+
+std::atomic<size_t> allocations { 0 };
+
+}
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+// not inlined, or GCC takes the free() for a mismatch with the library operator new
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+template <typename T, size_t N>
+void randomise(std::vector<std::array<T, N>>& data, std::mt19937& random) {
+  for (auto& point : data) {
+    for (auto& coordinate : point) coordinate = static_cast<T>(random() % 10000) / 10.0;
+  }
+}
+
+// The first run grows the workspace; the rest, over new data of the same size, reuse it
+template <typename T, size_t N>
+void checkWorkspaceRuns(const char* what) {
+  std::mt19937 random { 3 };
+  std::vector<std::array<T, N>> data(2000);
+  dkm::clustering_parameters<T> parameters { 12 };
+  parameters.set_max_iteration(100);
+  dkm::kmeans_workspace<T, N> workspace;
+
+  randomise(data, random);
+  parameters.set_random_seed(0);
+  dkm::kmeans_lloyd(data, parameters, workspace);
+
+  size_t before = allocations;
+  for (uint64_t run = 1; run <= 40; run++) {
+    randomise(data, random);
+    parameters.set_random_seed(run);
+    dkm::kmeans_lloyd(data, parameters, workspace);
+  }
+  check(allocations == before, what);
+}
+
+// With and without the iteration and movement limits
+void checkWorkspaceMatchesLloyd(const char* what) {
+  std::mt19937 random { 7 };
+  std::vector<std::array<float, 2>> data(1000);
+  dkm::kmeans_workspace<float, 2> workspace;
+  bool same = true;
+  for (uint64_t run = 0; run < 20; run++) {
+    randomise(data, random);
+    dkm::clustering_parameters<float> parameters { static_cast<uint32_t>(5 + run % 7) };
+    parameters.set_random_seed(run);
+    if (run % 2) parameters.set_min_delta(0.5f);
+    if (run % 3 == 0) parameters.set_max_iteration(4);
+    auto lloyd = dkm::kmeans_lloyd(data, parameters);
+    dkm::kmeans_lloyd(data, parameters, workspace);
+    same = same && std::get<0>(lloyd) == workspace.means && std::get<1>(lloyd) == workspace.clusters;
+  }
+  check(same, what);
+}
+
+// Over several seeds, with the iteration limit cutting some runs short and with clusters of points
+// that tie on whole-number coordinates
+template <typename T, size_t N>
+void checkHamerlyMatchesLloyd(const char* what) {
+  std::mt19937 random { 11 };
+  std::vector<std::array<T, N>> data(1500);
+  bool same = true;
+  for (uint64_t run = 0; run < 20; run++) {
+    randomise(data, random);
+    if (run % 2) {
+      for (auto& point : data) {
+        for (auto& coordinate : point) coordinate = std::floor(coordinate / 100);
+      }
+    }
+    dkm::clustering_parameters<T> parameters { static_cast<uint32_t>(4 + run) };
+    parameters.set_random_seed(run);
+    if (run % 3 == 0) parameters.set_max_iteration(5);
+    auto lloyd = dkm::kmeans_lloyd(data, parameters);
+    auto hamerly = dkm::kmeans_hamerly(data, parameters);
+    same = same && std::get<0>(lloyd) == std::get<0>(hamerly) && std::get<1>(lloyd) == std::get<1>(hamerly);
+  }
+  check(same, what);
+}
+
+// Ring-buffer updates and refinement, the way BellsEngine clusters notes each frame
+void checkStateFrames(size_t threads, const char* what) {
+  std::mt19937 random { 5 };
+  std::vector<std::array<float, 2>> data(3000);
+  randomise(data, random);
+  dkm::clustering_parameters<float> parameters { 14 };
+  parameters.set_random_seed(1);
+  dkm::kmeans_state<float, 2> state { parameters };
+  dkm::thread_pool pool { threads };
+  state.seed(data);
+
+  auto frame = [&](size_t index) {
+    std::array<float, 2> old = data[index];
+    data[index] = { static_cast<float>(random() % 10000) / 10.0f, static_cast<float>(random() % 10000) / 10.0f };
+    state.replace_point(index, old, data[index]);
+    dkm::refine_parallel(state, data, 4, pool);
+  };
+  // the first frames grow the scratch buffers and start the pool's threads
+  for (size_t i = 0; i < 10; i++) frame(i);
+
+  size_t before = allocations;
+  for (size_t i = 10; i < 5000; i++) frame(i % data.size());
+  check(allocations == before, what);
+}
+
+}
+
+int main() {
+  {
+    // the counter does see allocations
+    std::vector<std::array<float, 2>> data(100, { 1.0f, 2.0f });
+    size_t before = allocations;
+    dkm::kmeans_lloyd(data, dkm::clustering_parameters<float> { 3 });
+    check(allocations > before, "kmeans_lloyd without a workspace is seen to allocate");
+  }
+  checkWorkspaceRuns<float, 2>("repeated float 2-D workspace runs allocate nothing");
+  checkWorkspaceRuns<double, 3>("repeated double 3-D workspace runs allocate nothing");
+  checkStateFrames(1, "steady-state frames on one thread allocate nothing");
+  checkStateFrames(4, "steady-state frames on four threads allocate nothing");
+  checkWorkspaceMatchesLloyd("the workspace kmeans_lloyd gives the allocating one's means and labels");
+  checkHamerlyMatchesLloyd<float, 2>("kmeans_hamerly gives kmeans_lloyd's float 2-D means and labels");
+  checkHamerlyMatchesLloyd<double, 3>("kmeans_hamerly gives kmeans_lloyd's double 3-D means and labels");
+
+  std::printf("%s\n", failures ? "KmeansWorkspaceTest failed" : "KmeansWorkspaceTest passed");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+// LineBatch's rectangles against the geometry of a rotated rectangle: each corner is length/2
+// along the segment and width/2 across it from its middle, in perimeter order, and the indices
+// cover it with two triangles when filled or go round its four edges when outlined. Each segment's
+// bounds are exactly its own corners'.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "LineBatch.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+  if (condition) return;
+  std::printf("FAIL: %s\n", what);
+  failures++;
+}
+
+bool near(float a, float b) {
+  return std::abs(a - b) < 1.0e-5f;
+}
+
+struct Segment {
+  glm::vec2 start, end;
+  float width;
+};
+
+// Segments at several angles, in the normalised coordinates the engine uses
+const std::vector<Segment> SEGMENTS {
+  { { 0.1f, 0.2f }, { 0.6f, 0.2f }, 0.01f }, // horizontal
+  { { 0.3f, 0.1f }, { 0.3f, 0.7f }, 0.02f }, // vertical
+  { { 0.2f, 0.2f }, { 0.5f, 0.6f }, 0.015f }, // 3-4-5
+  { { 0.9f, 0.8f }, { 0.1f, 0.3f }, 0.005f }, // backwards
+};
+const glm::vec2 SCALE { 6000.0f, 1200.0f }; // not square, like the canvas
+
+// The corner's position unscaled, relative to the segment's middle, along and across the segment
+glm::vec2 segmentFrame(const glm::vec3& corner, const Segment& segment) {
+  float x = corner.x / SCALE.x - (segment.start.x + segment.end.x) / 2.0f;
+  float y = corner.y / SCALE.y - (segment.start.y + segment.end.y) / 2.0f;
+  float dx = segment.end.x - segment.start.x;
+  float dy = segment.end.y - segment.start.y;
+  float length = std::sqrt(dx * dx + dy * dy);
+  return { (x * dx + y * dy) / length, (-x * dy + y * dx) / length };
+}
+
+void checkBounds(const LineBatch& batch) {
+  const auto& segmentBounds = batch.getSegmentBounds();
+  check(segmentBounds.size() == SEGMENTS.size(), "bounds for each segment");
+  for (size_t i = 0; i < segmentBounds.size() && batch.getVertices().size() == 4 * SEGMENTS.size(); i++) {
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    for (size_t corner = 0; corner < 4; corner++) {
+      const glm::vec3& vertex = batch.getVertices()[4 * i + corner];
+      minX = std::min(minX, vertex.x);
+      minY = std::min(minY, vertex.y);
+      maxX = std::max(maxX, vertex.x);
+      maxY = std::max(maxY, vertex.y);
+    }
+    const auto& bounds = segmentBounds[i];
+    check(bounds.min.x == minX && bounds.min.y == minY && bounds.max.x == maxX && bounds.max.y == maxY,
+          "a segment's bounds are its own corners'");
+  }
+}
+
+void checkCorners(const LineBatch& batch) {
+  checkBounds(batch);
+  check(batch.getVertices().size() == 4 * SEGMENTS.size(), "four corners per segment");
+  for (size_t i = 0; i < SEGMENTS.size(); i++) {
+    const Segment& segment = SEGMENTS[i];
+    float halfLength = std::hypot(segment.end.x - segment.start.x, segment.end.y - segment.start.y) / 2.0f;
+    float halfWidth = segment.width / 2.0f;
+    glm::vec2 corners[4];
+    for (size_t corner = 0; corner < 4; corner++) {
+      const glm::vec3& vertex = batch.getVertices()[4 * i + corner];
+      corners[corner] = segmentFrame(vertex, segment);
+      check(vertex.z == 0.0f, "corners are in the plane");
+    }
+    // start and end on one side, then end and start on the other
+    glm::vec2 expected[4] { { -halfLength, -halfWidth }, { halfLength, -halfWidth }, { halfLength, halfWidth }, { -halfLength, halfWidth } };
+    for (size_t corner = 0; corner < 4; corner++) {
+      check(near(corners[corner].x, expected[corner].x) && near(corners[corner].y, expected[corner].y),
+            "corners are length/2 along and width/2 across the segment, in perimeter order");
+    }
+  }
+}
+
+float triangleArea(glm::vec2 a, glm::vec2 b, glm::vec2 c) {
+  return std::abs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) / 2.0f;
+}
+
+void checkFilled() {
+  LineBatch batch;
+  batch.clear(true);
+  for (const auto& segment : SEGMENTS) batch.add(segment.start, segment.end, segment.width, SCALE);
+  check(batch.isFilled(), "filled batch is filled");
+  checkCorners(batch);
+
+  const auto& indices = batch.getIndices();
+  check(indices.size() == 6 * SEGMENTS.size(), "two triangles per filled segment");
+  for (size_t i = 0; i < SEGMENTS.size() && indices.size() == 6 * SEGMENTS.size(); i++) {
+    const Segment& segment = SEGMENTS[i];
+    float length = std::hypot(segment.end.x - segment.start.x, segment.end.y - segment.start.y);
+    uint32_t first = 4 * i;
+    glm::vec2 corners[6];
+    bool inSegment = true;
+    for (size_t j = 0; j < 6; j++) {
+      uint32_t index = indices[6 * i + j];
+      inSegment = inSegment && index >= first && index < first + 4;
+      if (inSegment) corners[j] = segmentFrame(batch.getVertices()[index], segment);
+    }
+    check(inSegment, "a segment's triangles only use its own corners");
+    if (!inSegment) continue;
+    // two halves of the rectangle split along a shared diagonal, so together they cover it exactly
+    float rectangleArea = length * segment.width;
+    check(near(triangleArea(corners[0], corners[1], corners[2]), rectangleArea / 2.0f), "first triangle is half the rectangle");
+    check(near(triangleArea(corners[3], corners[4], corners[5]), rectangleArea / 2.0f), "second triangle is half the rectangle");
+    std::vector<uint32_t> shared;
+    for (size_t j = 0; j < 3; j++) {
+      for (size_t k = 3; k < 6; k++) {
+        if (indices[6 * i + j] == indices[6 * i + k]) shared.push_back(indices[6 * i + j]);
+      }
+    }
+    check(shared.size() == 2 && (shared[0] - first) % 2 == (shared[1] - first) % 2, "triangles share a diagonal");
+  }
+}
+
+void checkOutlined() {
+  LineBatch batch;
+  batch.clear(false);
+  for (const auto& segment : SEGMENTS) batch.add(segment.start, segment.end, segment.width, SCALE);
+  check(!batch.isFilled(), "outlined batch is outlined");
+  checkCorners(batch);
+
+  const auto& indices = batch.getIndices();
+  check(indices.size() == 8 * SEGMENTS.size(), "four lines per outlined segment");
+  for (size_t i = 0; i < SEGMENTS.size() && indices.size() == 8 * SEGMENTS.size(); i++) {
+    uint32_t first = 4 * i;
+    // each line starts where the last ended, visiting every corner and closing the loop
+    bool edges = true;
+    for (size_t line = 0; line < 4; line++) {
+      uint32_t from = indices[8 * i + 2 * line];
+      uint32_t to = indices[8 * i + 2 * line + 1];
+      edges = edges && from == first + line && to == first + (line + 1) % 4;
+    }
+    check(edges, "outline lines go round the perimeter");
+  }
+}
+
+void checkDegenerate() {
+  LineBatch batch;
+  batch.clear(true);
+  batch.add({ 0.4f, 0.4f }, { 0.4f, 0.4f }, 0.01f, SCALE);
+  check(batch.isEmpty() && batch.getVertices().empty() && batch.getSegmentBounds().empty(), "zero length segments add nothing");
+  batch.add({ 0.1f, 0.1f }, { 0.2f, 0.1f }, 0.01f, SCALE);
+  batch.clear(false);
+  check(batch.isEmpty() && batch.getVertices().empty() && batch.getSegmentBounds().empty() && !batch.isFilled(), "clear empties and sets the mode");
+}
+
+}
+
+int main() {
+  checkFilled();
+  checkOutlined();
+  checkDegenerate();
+
+  std::printf("%s\n", failures ? "LineBatchTest failed" : "LineBatchTest passed");
+  return failures ? 1 : 0;
+}